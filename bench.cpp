@@ -0,0 +1,495 @@
+/// Benchmark `ConnectedPads` logic on a simulated backend
+///
+/// Each scenario measures the simulated time needed to reach the expected layout:
+/// all slots used, except the target one.
+/// Logic overhead (actual CPU time) is measured by repeating each scenario.
+///
+/// With `--replay FILE`, a trace recorded by `gamepad-slotter --record` is run instead.
+/// With `--soak`, random changes are handled for a long simulated time, see `soak()`.
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pads.h"
+#include "record.h"
+#include "sim.h"
+
+using BenchPads = ConnectedPads<SimBackend>;
+
+
+
+struct Scenario {
+  std::string m_name;
+  size_t m_target;
+  std::vector<SimBackend::PhysicalEvent> m_events;
+  std::function<void(SimBackend::Config&)> m_configure = nullptr;
+  SimBackend::Duration m_idle{};  // keep waiting once ready, to measure idle cost
+  bool m_until_physical = false;  // ready once a physical device uses the target slot, instead
+  std::optional<SimBackend::Duration> m_open_at = std::nullopt;  // reserve all slots, free the target at this time for an arriving device
+};
+
+struct Result {
+  bool m_ready = false;
+  SimBackend::Duration m_time_to_ready{};
+  SimBackend::Stats m_stats;
+};
+
+/// Return `true` if all slots but the target one are actually used
+bool isReady(SimBackend const& backend, size_t target) {
+  for (size_t i = 0; i < SimBackend::slot_count; ++i) {
+    if (backend.isSlotUsed(i) != (i != target)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Run a scenario the way the wait loop of `main()` does
+Result run(Scenario const& scenario) {
+  SimBackend::Config config;
+  if (scenario.m_configure) {
+    scenario.m_configure(config);
+  }
+
+  Result result;
+  try {
+    BenchPads pads(config, scenario.m_events);
+    auto& backend = pads.m_backend;
+    auto const start = backend.now();
+    auto constexpr timeout = 10s;
+    auto constexpr poll_delay = 10ms;
+
+    auto const ready = [&] {
+      if (scenario.m_until_physical) {
+        return backend.hasPhysicalDevice(scenario.m_target) && pads.hasRealPad(scenario.m_target);
+      }
+      return isReady(backend, scenario.m_target);
+    };
+
+    // Just-in-time target: reserve it too, free it on arrival like `DeviceRouter` does
+    bool open = scenario.m_open_at.has_value();
+    BenchPads::Layout reserved;
+    reserved.fill(BenchPads::SlotGoal::Reserved);
+    auto const fill = [&] {
+      if (!scenario.m_open_at) {
+        pads.fillAllButOne(scenario.m_target);
+      } else if (!pads.hasRealPad(scenario.m_target)) {
+        pads.reconcile(reserved);
+      }
+    };
+
+    fill();
+    while (!ready() && backend.now() - start < timeout) {
+      backend.sleep(poll_delay);
+      bool changed = pads.updatePlugged();
+      if (open && backend.now() - start >= scenario.m_open_at.value()) {
+        open = false;
+        pads.freeSlot(scenario.m_target);
+        pads.waitRealPad(scenario.m_target, 2s);
+        changed = true;
+      }
+      if (changed) {
+        fill();
+      }
+    }
+    result.m_ready = ready();
+    result.m_time_to_ready = backend.now() - start;
+
+    for (auto const idle_end = backend.now() + scenario.m_idle; backend.now() < idle_end;) {
+      backend.sleep(poll_delay);
+      pads.updatePlugged();
+    }
+    result.m_stats = backend.stats();
+  } catch (std::exception const&) {
+    result.m_ready = false;
+  }
+  return result;
+}
+
+/// Physical devices plugged at startup, without gaps
+std::vector<SimBackend::PhysicalEvent> prePlugged(size_t count) {
+  std::vector<SimBackend::PhysicalEvent> events;
+  for (size_t i = 0; i < count; ++i) {
+    events.push_back({0ms, i, true});
+  }
+  return events;
+}
+
+std::vector<Scenario> scenarios() {
+  std::vector<Scenario> scenarios;
+  scenarios.push_back({"empty, target 1", 0, {}});
+  for (size_t count = 0; count < SimBackend::slot_count; ++count) {
+    scenarios.push_back({std::format("{} pre-plugged, target 4", count), 3, prePlugged(count)});
+  }
+  scenarios.push_back({"slots 1 and 3 plugged, target 2", 1, {{0ms, 0, true}, {0ms, 1, true}, {0ms, 2, true}, {0ms, 1, false}}});
+
+  auto unplugged = prePlugged(2);
+  unplugged.push_back({10ms, 0, false});
+  scenarios.push_back({"2 pre-plugged, 1 unplugged mid-fill, target 4", 3, unplugged});
+
+  scenarios.push_back({"device plugged mid-fill, target 4", 3, {{20ms, 0, true}}});
+
+  scenarios.push_back({"idle for 60s, target 1", 0, {}, nullptr, 60s});
+  scenarios.push_back({"idle for 60s, 2 pre-plugged, target 4", 3, prePlugged(2), nullptr, 60s});
+
+  // All slots are used: the arriving device takes the target as soon as it is freed
+  scenarios.push_back({"device arrival on a just-in-time target 2", 1, {{100ms, 9, true}}, nullptr, {}, true, 100ms});
+
+  scenarios.push_back({"no notifications, target 1", 0, {}, [](auto& config) { config.notification_latency.reset(); }});
+  scenarios.push_back({"no notifications, device plugged mid-fill, target 4", 3, {{20ms, 0, true}},
+                       [](auto& config) { config.notification_latency.reset(); }});
+  return scenarios;
+}
+
+/// Scenario rebuilt from a recorded trace
+struct Replay {
+  Scenario m_scenario;
+  std::optional<SimBackend::Duration> m_recorded_time;  // time to get a real pad on the first target
+};
+
+/// Rebuild a scenario from recorded events
+///
+/// Driver timings are the median of recorded ones, physical changes are replayed at their recorded time.
+Replay replay(std::vector<Recorder::Record> const& records, std::string_view name) {
+  using Duration = SimBackend::Duration;
+  if (records.empty()) {
+    throw std::runtime_error("empty record file");
+  }
+
+  auto const median = [](std::vector<Duration> values) -> std::optional<Duration> {
+    if (values.empty()) {
+      return std::nullopt;
+    }
+    auto const middle = values.begin() + values.size() / 2;
+    std::ranges::nth_element(values, middle);
+    return *middle;
+  };
+  auto const duration = [](Recorder::Record const& record) -> Duration { return std::chrono::microseconds(record.m_duration_us); };
+
+  auto const origin = records.front().m_time;
+  std::vector<Duration> add_latencies, assign_latencies, remove_latencies, probe_plugged_costs, probe_empty_costs;
+  std::optional<int64_t> add_end;
+  bool notified = false;
+  std::optional<Recorder::Record> target, reached;
+
+  // Slots are assigned to the first free slot: plug devices on all slots, then unplug the empty ones
+  Replay result;
+  auto& events = result.m_scenario.m_events;
+  std::map<size_t, size_t> devices;  // device of each slot
+  size_t next_device = 0;
+  size_t initial_count = 0;
+  std::vector<size_t> initially_empty;  // devices to unplug after initial ones
+
+  for (auto const& record : records) {
+    auto const time = Duration(record.m_time - origin);
+    switch (record.m_kind) {
+      case RecordKind::Initial:
+        if (record.m_value) {
+          devices[record.m_slot] = next_device;
+        } else {
+          initially_empty.push_back(next_device);
+        }
+        events.push_back({0ms, next_device++, true});
+        ++initial_count;
+        break;
+      case RecordKind::Probe:
+        (record.m_value ? probe_plugged_costs : probe_empty_costs).push_back(duration(record));
+        break;
+      case RecordKind::Physical:
+        if (record.m_value) {
+          devices[record.m_slot] = next_device;
+          events.push_back({time, next_device++, true});
+        } else if (auto it = devices.find(record.m_slot); it != devices.end()) {
+          events.push_back({time, it->second, false});
+          devices.erase(it);
+        }
+        break;
+      case RecordKind::Add:
+        add_latencies.push_back(duration(record));
+        add_end = record.m_time + std::chrono::nanoseconds(duration(record)).count();
+        break;
+      case RecordKind::Place:
+        notified |= record.m_value != 0;
+        if (add_end) {
+          assign_latencies.push_back(Duration(std::max<int64_t>(0, record.m_time - *add_end)));
+        }
+        break;
+      case RecordKind::Remove:
+        break;
+      case RecordKind::Freed:
+        if (!record.m_value) {
+          remove_latencies.push_back(duration(record));
+        }
+        break;
+      case RecordKind::Target:
+        if (!target && record.m_slot != Recorder::no_slot) {
+          target = record;
+        }
+        break;
+      case RecordKind::Reached:
+        if (target && !reached && record.m_slot == target->m_slot) {
+          reached = record;
+        }
+        break;
+    }
+  }
+  for (auto const device : initially_empty) {
+    events.insert(events.begin() + initial_count, {0ms, device, false});
+  }
+
+  auto& scenario = result.m_scenario;
+  scenario.m_name = std::format("replay: {}", name);
+  scenario.m_target = target ? target->m_slot : 0;
+  auto const config = SimBackend::Config{
+      .add_latency = median(add_latencies).value_or(SimBackend::Config{}.add_latency),
+      .assign_latency = median(assign_latencies).value_or(SimBackend::Config{}.assign_latency),
+      .remove_latency = median(remove_latencies).value_or(SimBackend::Config{}.remove_latency),
+      .probe_plugged_cost = median(probe_plugged_costs).value_or(SimBackend::Config{}.probe_plugged_cost),
+      .probe_empty_cost = median(probe_empty_costs).value_or(SimBackend::Config{}.probe_empty_cost),
+  };
+  scenario.m_configure = [config, notified](SimBackend::Config& c) {
+    c = config;
+    if (!notified) {
+      c.notification_latency.reset();
+    }
+  };
+  if (target && reached) {
+    result.m_recorded_time = Duration(reached->m_time - target->m_time);
+    scenario.m_until_physical = true;  // measure the same as the recording
+  }
+  return result;
+}
+
+/// Handle random device changes for a long time, as a daemon would
+///
+/// Two slots are reserved, as for a two-player game. Physical devices are plugged and
+/// unplugged at random intervals, sometimes in bursts. After each change, slots are polled
+/// until the layout is settled: all slots used except the current target, or no virtual
+/// pads once all targets have a physical device.
+/// Fail if reaction latency, slowdown over time, growth of simulated objects or leaked virtual pads exceed thresholds.
+/// Memory is tracked through objects which can grow: simulated devices and pending driver events.
+bool soak(size_t event_count) {
+  using Duration = SimBackend::Duration;
+  static constexpr size_t device_count = 3;  // fewer than slots, so that fillers are needed
+  std::vector<size_t> const targets = {0, 1};
+  static constexpr auto poll_delay = 10ms;
+  static constexpr auto settle_timeout = 5s;
+
+  static constexpr auto max_p99_latency = 500ms;
+  static constexpr double max_slowdown = 2.0;  // CPU time per event, last window over first one
+  static constexpr size_t max_objects = 2 * (device_count + SimBackend::slot_count);  // devices and pending events
+  static constexpr size_t window = 10;  // size of first and last windows, in percent of events
+
+  // Latencies are counted by millisecond, to not allocate while running
+  static std::array<uint32_t, std::chrono::milliseconds(settle_timeout).count() + 1> latencies_ms{};
+  latencies_ms.fill(0);
+
+  std::mt19937 random(42);
+  std::uniform_int_distribution<size_t> pick_device(0, device_count - 1);
+  std::uniform_int_distribution<int> pick_gap_ms(20, 300);
+  std::bernoulli_distribution pick_burst(0.1);
+
+  SimBackend::Config const config;
+  BenchPads pads(config, std::vector<SimBackend::PhysicalEvent>{});
+  auto& backend = pads.m_backend;
+  std::array<bool, device_count> plugged{};
+
+  // Reconcile like the daemon does: fill for the next target, free all once done
+  auto const reconcile = [&] {
+    if (auto const target = pads.nextTarget(targets)) {
+      pads.fillAllButOne(*target);
+    } else {
+      pads.freeAll();
+    }
+  };
+
+  // The expected target depends on actual devices, not on the state known by `pads`
+  auto const settled = [&] {
+    auto const it = std::ranges::find_if(targets, [&](size_t i) { return !backend.hasPhysicalDevice(i); });
+    auto const target = it == targets.end() ? std::nullopt : std::optional(*it);
+    if (!target) {
+      return backend.liveTargets() == 0;
+    }
+    for (size_t i = 0; i < SimBackend::slot_count; ++i) {
+      bool const expected = i != *target || backend.hasPhysicalDevice(*target);
+      if (backend.isSlotUsed(i) != expected) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  size_t unsettled = 0;
+  size_t peak_targets = 0;
+  size_t peak_objects = 0;
+  auto const first_window_end = event_count * window / 100;
+  auto const last_window_start = event_count - first_window_end;
+  std::chrono::steady_clock::duration first_cpu{};
+  std::chrono::steady_clock::duration last_cpu{};
+  auto window_start = std::chrono::steady_clock::now();
+  auto const cpu_start = window_start;
+
+  reconcile();
+  for (size_t n = 0; n < event_count; ++n) {
+    if (n == last_window_start) {
+      window_start = std::chrono::steady_clock::now();
+    }
+
+    auto const device = pick_device(random);
+    plugged[device] = !plugged[device];
+    Duration const gap = pick_burst(random) ? Duration(1ms) : std::chrono::milliseconds(pick_gap_ms(random));
+    auto const event_time = backend.now() + gap;
+    backend.schedulePhysical({event_time.time_since_epoch(), device, plugged[device]});
+
+    // Poll until settled; bursts chain changes before the previous one settles
+    backend.sleepUntil(event_time);
+    while (!settled() && backend.now() - event_time < settle_timeout) {
+      backend.sleep(poll_delay);
+      peak_objects = std::max(peak_objects, backend.deviceCount() + backend.pendingEvents());
+      if (pads.updatePlugged()) {
+        reconcile();
+      }
+    }
+    if (settled()) {
+      auto const latency = std::chrono::duration_cast<std::chrono::milliseconds>(backend.now() - event_time);
+      ++latencies_ms[std::min<size_t>(latency.count(), latencies_ms.size() - 1)];
+    } else {
+      ++unsettled;
+    }
+    peak_targets = std::max(peak_targets, backend.liveTargets());
+
+    if (n + 1 == first_window_end) {
+      first_cpu = std::chrono::steady_clock::now() - window_start;
+    }
+  }
+  last_cpu = std::chrono::steady_clock::now() - window_start;
+  auto const total_cpu = std::chrono::duration<double>(std::chrono::steady_clock::now() - cpu_start).count();
+
+  // All virtual pads must be gone once freed
+  pads.freeAll();
+  backend.sleep(1s);
+  auto const leaked = backend.liveTargets();
+
+  auto const percentile = [&](double p) {
+    auto const settled_count = event_count - unsettled;
+    size_t cumulated = 0;
+    for (size_t ms = 0; ms < latencies_ms.size(); ++ms) {
+      cumulated += latencies_ms[ms];
+      if (cumulated >= p * settled_count) {
+        return std::chrono::milliseconds(ms);
+      }
+    }
+    return std::chrono::milliseconds(settle_timeout);
+  };
+  auto const p50 = percentile(0.50);
+  auto const p99 = percentile(0.99);
+  auto const slowdown = first_cpu.count() ? static_cast<double>(last_cpu.count()) / first_cpu.count() : 1.0;
+
+  std::cout << std::format("events: {}, simulated time: {:.1f} h, throughput: {:.0f} events/s\n",
+                           event_count, std::chrono::duration<double, std::ratio<3600>>(backend.now().time_since_epoch()).count(),
+                           event_count / total_cpu);
+  std::cout << std::format("reaction latency: p50 {} ms, p99 {} ms, unsettled: {}\n", p50.count(), p99.count(), unsettled);
+  std::cout << std::format("peak simulated objects: {}, slowdown: {:.2f}\n", peak_objects, slowdown);
+  std::cout << std::format("peak virtual pads: {}, leaked virtual pads: {}\n", peak_targets, leaked);
+
+  bool success = true;
+  auto const check = [&](bool ok, std::string_view what) {
+    if (!ok) {
+      std::cout << std::format("FAILED: {}\n", what);
+      success = false;
+    }
+  };
+  check(unsettled == 0, "some changes never settled");
+  check(p99 <= max_p99_latency, std::format("p99 reaction latency above {} ms", max_p99_latency.count()));
+  check(slowdown <= max_slowdown, std::format("slowdown above {:.1f}", max_slowdown));
+  check(peak_objects <= max_objects, std::format("more than {} simulated objects", max_objects));
+  check(peak_targets < SimBackend::slot_count, "more virtual pads than fillable slots");
+  check(leaked == 0, "virtual pads leaked");
+  return success;
+}
+
+/// Run a scenario, print its results
+///
+/// Return `true` if the expected layout has been reached.
+bool bench(Scenario const& scenario, int iterations) {
+  // The logger is not started: `ConnectedPads` logs are dropped
+  Result const result = run(scenario);
+  auto const cpu_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    run(scenario);
+  }
+  auto const cpu_time = (std::chrono::steady_clock::now() - cpu_start) / iterations;
+
+  auto const ms = std::chrono::duration<double, std::milli>(result.m_time_to_ready).count();
+  auto const us = std::chrono::duration<double, std::micro>(cpu_time).count();
+  auto const probe_ms = std::chrono::duration<double, std::milli>(result.m_stats.m_probe_time).count();
+  std::cout << std::format("{:<52} {:>5} {:>10.1f} {:>5} {:>7} {:>6} {:>10.1f} {:>9.1f}\n",
+                           scenario.m_name, result.m_ready ? "yes" : "NO", ms, result.m_stats.m_added,
+                           result.m_stats.m_removed, result.m_stats.m_probes, probe_ms, us);
+  return result.m_ready;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::optional<std::string> replay_path;
+  bool soak_mode = false;
+  int iterations = 1000;
+  int arg = 1;
+  if (arg + 1 < argc && std::string_view(argv[arg]) == "--replay") {
+    replay_path = argv[arg + 1];
+    arg += 2;
+  } else if (arg < argc && std::string_view(argv[arg]) == "--soak") {
+    soak_mode = true;
+    iterations = 1'000'000;
+    ++arg;
+  }
+  if (arg + 1 == argc) {
+    iterations = std::atoi(argv[arg++]);
+  }
+  if (iterations <= 0 || arg != argc) {
+    std::cerr << std::format("usage: {} [--replay FILE] [ITERATIONS]\n", argv[0]);
+    std::cerr << std::format("       {} --soak [EVENTS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (soak_mode) {
+    return soak(iterations) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  std::vector<Scenario> to_run;
+  std::optional<SimBackend::Duration> recorded_time;
+  if (replay_path) {
+    try {
+      auto result = replay(Recorder::read(*replay_path), *replay_path);
+      to_run.push_back(std::move(result.m_scenario));
+      recorded_time = result.m_recorded_time;
+    } catch (std::exception const& e) {
+      std::cerr << "FATAL: " << e.what() << "\n";
+      return EXIT_FAILURE;
+    }
+  } else {
+    to_run = scenarios();
+  }
+
+  std::cout << std::format("{:<52} {:>5} {:>10} {:>5} {:>7} {:>6} {:>10} {:>9}\n",
+                           "scenario", "ready", "time (ms)", "added", "removed", "probes", "probe (ms)", "cpu (us)");
+
+  bool success = true;
+  for (auto const& scenario : to_run) {
+    success &= bench(scenario, iterations);
+  }
+  if (recorded_time) {
+    std::cout << std::format("recorded time to target: {:.1f} ms\n", std::chrono::duration<double, std::milli>(*recorded_time).count());
+  }
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <format>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+/// Severity of a log message
+enum class Severity { Info, Warning, Error };
+
+/// Asynchronous logger
+///
+/// Messages are formatted into a preallocated ring buffer and written by a background thread,
+/// callers never wait for I/O. Messages are dropped if the buffer is full or if the logger is not started.
+struct Logger {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t capacity = 256;
+  static constexpr size_t max_size = 240;  // longer messages are truncated
+
+  struct Entry {
+    Clock::time_point m_time;
+    Severity m_severity;
+    size_t m_size;
+    char m_text[max_size];
+  };
+
+  Logger() = default;
+  Logger(Logger const&) = delete;
+  Logger& operator=(Logger const&) = delete;
+  ~Logger() { stop(); }
+
+  /// Start writing messages, warnings and errors are written to `err`
+  ///
+  /// Streams must outlive the logger, or the call to `stop()`.
+  void start(std::ostream& out, std::ostream& err, Severity min_severity = Severity::Info) {
+    m_out = &out;
+    m_err = &err;
+    m_min_severity = min_severity;
+    m_origin = Clock::now();
+    m_stopping = false;
+    m_thread = std::thread([this] { drain(); });
+    m_running = true;
+  }
+
+  /// Write pending messages, then stop the background thread
+  void stop() {
+    if (!m_thread.joinable()) {
+      return;
+    }
+    m_running = false;
+    {
+      std::lock_guard lock(m_mutex);
+      m_stopping = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+  }
+
+  template <class... Args>
+  void log(Severity severity, std::format_string<Args...> fmt, Args&&... args) {
+    if (!m_running || severity < m_min_severity) {
+      return;
+    }
+    Entry entry;
+    entry.m_time = Clock::now();
+    entry.m_severity = severity;
+    auto const result = std::format_to_n(entry.m_text, max_size, fmt, std::forward<Args>(args)...);
+    entry.m_size = std::min(static_cast<size_t>(result.size), max_size);
+    {
+      std::lock_guard lock(m_mutex);
+      if (m_count == capacity) {
+        ++m_dropped;
+        return;
+      }
+      auto& slot = m_entries[(m_first + m_count) % capacity];
+      slot.m_time = entry.m_time;
+      slot.m_severity = entry.m_severity;
+      slot.m_size = entry.m_size;
+      std::memcpy(slot.m_text, entry.m_text, entry.m_size);
+      ++m_count;
+    }
+    m_cv.notify_one();
+  }
+
+  template <class... Args>
+  void info(std::format_string<Args...> fmt, Args&&... args) { log(Severity::Info, fmt, std::forward<Args>(args)...); }
+  template <class... Args>
+  void warning(std::format_string<Args...> fmt, Args&&... args) { log(Severity::Warning, fmt, std::forward<Args>(args)...); }
+  template <class... Args>
+  void error(std::format_string<Args...> fmt, Args&&... args) { log(Severity::Error, fmt, std::forward<Args>(args)...); }
+
+ private:
+  /// Write messages until stopped, run by the background thread
+  void drain() {
+    std::unique_lock lock(m_mutex);
+    for (;;) {
+      m_cv.wait(lock, [&] { return m_count || m_dropped || m_stopping; });
+      if (m_dropped) {
+        auto const dropped = std::exchange(m_dropped, 0);
+        lock.unlock();
+        *m_err << std::format("WARNING: {} log messages dropped\n", dropped);
+        lock.lock();
+      } else if (m_count) {
+        auto const entry = m_entries[m_first];
+        m_first = (m_first + 1) % capacity;
+        --m_count;
+        bool const last = m_count == 0;
+        lock.unlock();
+        write(entry);
+        if (last) {
+          m_out->flush();
+          m_err->flush();
+        }
+        lock.lock();
+      } else {
+        break;  // stopping, and nothing left to write
+      }
+    }
+  }
+
+  void write(Entry const& entry) {
+    auto const seconds = std::chrono::duration<double>(entry.m_time - m_origin).count();
+    std::string_view const text(entry.m_text, entry.m_size);
+    switch (entry.m_severity) {
+      case Severity::Info:
+        *m_out << std::format("[{:9.3f}] {}\n", seconds, text);
+        break;
+      case Severity::Warning:
+        *m_err << std::format("[{:9.3f}] WARNING: {}\n", seconds, text);
+        break;
+      case Severity::Error:
+        *m_err << std::format("[{:9.3f}] ERROR: {}\n", seconds, text);
+        break;
+    }
+  }
+
+  std::ostream* m_out = nullptr;
+  std::ostream* m_err = nullptr;
+  Severity m_min_severity = Severity::Info;
+  Clock::time_point m_origin;
+  std::atomic<bool> m_running = false;
+  std::thread m_thread;
+
+  std::mutex m_mutex;  // protect members below
+  std::condition_variable m_cv;
+  std::array<Entry, capacity> m_entries;
+  size_t m_first = 0;
+  size_t m_count = 0;
+  size_t m_dropped = 0;
+  bool m_stopping = false;
+};
+
+inline Logger g_logger;
@@ -1,17 +1,45 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
+#include <cwctype>
+#include <exception>
 #include <format>
+#include <fstream>
+#include <initializer_list>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <avrt.h>
+#include <cfgmgr32.h>
+#include <setupapi.h>
+#include <tlhelp32.h>
 #include <XInput.h>
 #include <ViGEm/Client.h>
 
+#include "log.h"
+#include "metrics.h"
+#include "pads.h"
+#include "queue.h"
+#include "record.h"
+#include "trace.h"
+
 namespace ranges = std::ranges;
 using namespace std::chrono_literals;
 
@@ -19,52 +47,197 @@ using namespace std::chrono_literals;
 // Code assume slot indexes are 1-character wide
 static_assert(XUSER_MAX_COUNT + 1 <= 9);
 
+
 /// Wrap ViGEmClient
+///
+/// The connection to the bus is established on first use, in case no pad is needed.
 struct VigemClient {
   using Pad = PVIGEM_TARGET;
 
-  VigemClient() {
+  VigemClient() = default;
+  VigemClient(VigemClient const&) = delete;
+  VigemClient& operator=(VigemClient const&) = delete;
+
+  /// Connect to the ViGEm bus, if not already connected
+  void connect() {
+    if (m_client) {
+      return;
+    }
     auto const client = vigem_alloc();
     if (!client) {
       throw std::runtime_error("vigem_alloc() failed");
     }
 
-    checkSuccess(vigem_connect(client), "vigem_connect() failed");
+    auto const trace = g_tracer.scope("connect");
+    auto const retval = vigem_connect(client);
+    if (!VIGEM_SUCCESS(retval)) {
+      vigem_free(client);
+      checkSuccess(retval, "vigem_connect() failed");
+    }
     m_client = client;
   }
 
   /// Register a virtual gamepad, return a handle to be used by other methods
   Pad addPad() {
-    auto const pad = vigem_target_x360_alloc();
-    if (!pad) {
-      throw std::runtime_error("vigem_target_x360_alloc() failed");
+    connect();
+    removeAbandoned();
+    auto const trace = g_tracer.scope("add");
+    auto const pad = acquireTarget();
+    auto const retval = vigem_target_add(m_client, pad);
+    if (!VIGEM_SUCCESS(retval)) {
+      vigem_target_free(pad);
+      checkSuccess(retval, "vigem_target_add() failed");
     }
 
-    checkSuccess(vigem_target_add(m_client, pad), "vigem_target_add() failed");
-
     m_pads.push_back(pad);
+    registerIndexNotification(pad);
     return pad;
   }
 
+  /// Register several virtual gamepads at once
+  ///
+  /// Additions are submitted concurrently, return once all of them completed, or on timeout.
+  /// Only successfully added pads are returned, in no particular order; failures are logged.
+  /// Throw if no pad could be added.
+  std::vector<Pad> addPads(size_t count, std::chrono::steady_clock::duration timeout) {
+    connect();
+    removeAbandoned();
+    auto const trace = g_tracer.scope("add-batch");
+    std::vector<Pad> pads;
+    try {
+      for (size_t i = 0; i < count; ++i) {
+        pads.push_back(acquireTarget());
+      }
+    } catch (...) {
+      m_pool.insert(m_pool.end(), pads.begin(), pads.end());
+      throw;
+    }
+
+    {
+      std::lock_guard lock(s_pending_adds.m_mutex);
+      for (auto const& pad : pads) {
+        s_pending_adds.m_results[pad] = std::nullopt;
+      }
+    }
+    for (auto const& pad : pads) {
+      auto const retval = vigem_target_add_async(m_client, pad, &onAddResult);
+      if (!VIGEM_SUCCESS(retval)) {
+        onAddResult(m_client, pad, retval);
+      }
+    }
+
+    // Wait for all results
+    std::map<PVIGEM_TARGET, std::optional<VIGEM_ERROR>> results;
+    {
+      std::unique_lock lock(s_pending_adds.m_mutex);
+      s_pending_adds.m_cv.wait_for(lock, timeout, [&] {
+        return ranges::all_of(pads, [&](Pad pad) { return s_pending_adds.m_results[pad].has_value(); });
+      });
+      for (auto const& pad : pads) {
+        results[pad] = s_pending_adds.m_results[pad];
+        if (results[pad]) {
+          s_pending_adds.m_results.erase(pad);
+        }
+      }
+    }
+
+    std::optional<VIGEM_ERROR> error;
+    std::vector<Pad> added;
+    size_t timed_out = 0;
+    for (auto const& [pad, retval] : results) {
+      if (!retval) {
+        // Still used by ViGEm threads, it cannot be freed yet
+        m_abandoned.push_back(pad);
+        ++timed_out;
+      } else if (VIGEM_SUCCESS(*retval)) {
+        m_pads.push_back(pad);
+        registerIndexNotification(pad);
+        added.push_back(pad);
+      } else {
+        vigem_target_free(pad);
+        error = *retval;
+      }
+    }
+    if (added.empty()) {
+      checkSuccess(error.value_or(VIGEM_ERROR_TIMED_OUT), "vigem_target_add_async() failed");
+    }
+    if (error) {
+      g_logger.warning("vigem_target_add_async() failed for some pads: 0x{:X}", static_cast<unsigned int>(*error));
+    }
+    if (timed_out) {
+      g_logger.warning("vigem_target_add_async() timeout for {} pads, they will be removed once added", timed_out);
+    }
+    return added;
+  }
+
+  /// Wait for the user index of a pad to be reported by ViGEm
+  ///
+  /// Return `std::nullopt` on timeout or if notifications are not available for this pad.
+  std::optional<size_t> waitPadIndex(Pad pad, std::chrono::steady_clock::time_point deadline) {
+    auto it = m_index_notifications.find(pad);
+    if (it == m_index_notifications.end()) {
+      return std::nullopt;
+    }
+    auto& notification = *it->second;
+    std::unique_lock lock(notification.m_mutex);
+    notification.m_cv.wait_until(lock, deadline, [&] { return notification.m_index.has_value(); });
+    return notification.m_index;
+  }
+
+  /// Query the user index of a pad, without waiting
+  ///
+  /// `vigem_target_x360_get_user_index()` is unreliable; it sometimes fails.
+  std::optional<size_t> queryPadIndex(Pad pad) {
+    ULONG index;
+    if (VIGEM_SUCCESS(vigem_target_x360_get_user_index(m_client, pad, &index)) && index < XUSER_MAX_COUNT) {
+      return index;
+    }
+    return std::nullopt;
+  }
+
   /// Remove a gamepad added with `addPad()`
   void removePad(Pad pad) {
+    removeAbandoned();
     auto it = ranges::find(m_pads, pad);
     if (it == m_pads.end()) {
       throw std::runtime_error("removePad(): invalid pad");
     }
 
-    vigem_target_remove(m_client, pad);
-    vigem_target_free(pad);
+    unregisterIndexNotification(pad);
     m_pads.erase(it);
+    if (VIGEM_SUCCESS(vigem_target_remove(m_client, pad)) && m_pool.size() < pool_capacity) {
+      m_pool.push_back(pad);  // keep it for the next `addPad()`
+    } else {
+      vigem_target_free(pad);
+    }
+  }
+
+  /// Connect and preallocate targets, so that adding pads does not have to
+  void warmUp(size_t count) {
+    connect();
+    while (m_pool.size() < std::min(count, pool_capacity)) {
+      auto const pad = vigem_target_x360_alloc();
+      if (!pad) {
+        throw std::runtime_error("vigem_target_x360_alloc() failed");
+      }
+      m_pool.push_back(pad);
+    }
   }
 
   ~VigemClient() {
+    removeAbandoned();  // pads still pending are leaked, ViGEm threads may still use them
     for (auto const& pad : m_pads) {
+      unregisterIndexNotification(pad);
       vigem_target_remove(m_client, pad);
       vigem_target_free(pad);
     }
-    vigem_disconnect(m_client);
-    vigem_free(m_client);
+    for (auto const& pad : m_pool) {
+      vigem_target_free(pad);
+    }
+    if (m_client) {
+      vigem_disconnect(m_client);
+      vigem_free(m_client);
+    }
   }
 
 
@@ -75,232 +248,2019 @@ struct VigemClient {
     }
   }
 
-  PVIGEM_CLIENT m_client;
-  std::vector<PVIGEM_TARGET> m_pads;
-};
+  /// Remove pads abandoned by `addPads()` whose addition has completed since
+  void removeAbandoned() {
+    std::vector<std::pair<Pad, VIGEM_ERROR>> completed;
+    {
+      std::lock_guard lock(s_pending_adds.m_mutex);
+      std::erase_if(m_abandoned, [&](Pad pad) {
+        auto const it = s_pending_adds.m_results.find(pad);
+        if (!it->second) {
+          return false;
+        }
+        completed.emplace_back(pad, *it->second);
+        s_pending_adds.m_results.erase(it);
+        return true;
+      });
+    }
+    for (auto const& [pad, retval] : completed) {
+      if (VIGEM_SUCCESS(retval)) {
+        vigem_target_remove(m_client, pad);
+      }
+      vigem_target_free(pad);
+    }
+  }
+
+  /// Get a detached target from the pool, or allocate a new one
+  Pad acquireTarget() {
+    if (!m_pool.empty()) {
+      auto const pad = m_pool.back();
+      m_pool.pop_back();
+      return pad;
+    }
+    auto const pad = vigem_target_x360_alloc();
+    if (!pad) {
+      throw std::runtime_error("vigem_target_x360_alloc() failed");
+    }
+    return pad;
+  }
+
+  /// User index reported by X360 notifications
+  struct IndexNotification {
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::optional<size_t> m_index;
+  };
 
-/// Manage state of connected pads
-struct ConnectedPads {
-  /// State of a gamepad slot
+  /// Register X360 notifications to retrieve the user index (LED number) of a pad
   ///
-  /// Some states are invalid/erroneous
-  struct Slot {
-    bool m_plugged = false;
-    VigemClient::Pad m_managed = nullptr;
+  /// Failures are not fatal: the index will have to be retrieved another way.
+  void registerIndexNotification(Pad pad) {
+    auto notification = std::make_unique<IndexNotification>();
+    auto const retval = vigem_target_x360_register_notification(m_client, pad, &onX360Notification, notification.get());
+    if (VIGEM_SUCCESS(retval)) {
+      m_index_notifications.emplace(pad, std::move(notification));
+    } else {
+      g_logger.warning("vigem_target_x360_register_notification() failed: 0x{:X}", static_cast<unsigned int>(retval));
+    }
+  }
+
+  void unregisterIndexNotification(Pad pad) {
+    auto it = m_index_notifications.find(pad);
+    if (it != m_index_notifications.end()) {
+      // Wait for the notification thread to stop before releasing its data
+      vigem_target_x360_unregister_notification(pad);
+      m_index_notifications.erase(it);
+    }
+  }
+
+  /// Results of `vigem_target_add_async()`, its callback has no user data
+  struct PendingAdds {
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<PVIGEM_TARGET, std::optional<VIGEM_ERROR>> m_results;
   };
 
-  ConnectedPads() {
-    // Initiliaze the state, don't log alreay connected pads
-    for (size_t i = 0; i < m_slots.size(); ++i) {
-      m_slots[i].m_plugged = isPadPlugged(i);
+  static VOID CALLBACK onAddResult(PVIGEM_CLIENT, PVIGEM_TARGET pad, VIGEM_ERROR retval) {
+    {
+      std::lock_guard lock(s_pending_adds.m_mutex);
+      s_pending_adds.m_results[pad] = retval;
     }
+    s_pending_adds.m_cv.notify_all();
   }
 
-  /// Return true if given slot is plugged
-  bool isPlugged(size_t index) const {
-    if (index >= m_slots.size()) {
-      std::cerr << std::format("ERROR: invalid slot: {}\n", index + 1);
+  static VOID CALLBACK onX360Notification(PVIGEM_CLIENT, PVIGEM_TARGET, UCHAR, UCHAR, UCHAR led_number, LPVOID user_data) {
+    if (led_number >= XUSER_MAX_COUNT) {
+      return;  // LED not set (yet)
+    }
+    auto& notification = *static_cast<IndexNotification*>(user_data);
+    {
+      std::lock_guard lock(notification.m_mutex);
+      notification.m_index = led_number;
     }
-    return m_slots.at(index).m_plugged;
+    notification.m_cv.notify_all();
   }
 
-  /// Print the current state
-  void printState() const {
-    std::cout << "State:";
-    for (size_t i = 0; i < m_slots.size(); ++i) {
-      auto const& slot = m_slots[i];
-      char state = '?';
-      if (slot.m_plugged && slot.m_managed) {
-        state = 'x';
-      } else if (slot.m_plugged && !slot.m_managed) {
-        state = '1' + i;
-      } else if (!slot.m_plugged && slot.m_managed) {
-        state = 'X';  // erroneous
-      } else if (!slot.m_plugged && !slot.m_managed) {
-        state = '-';
+  /// Maximum number of detached targets kept for reuse
+  static constexpr size_t pool_capacity = XUSER_MAX_COUNT;
+
+  PVIGEM_CLIENT m_client = nullptr;
+  std::vector<PVIGEM_TARGET> m_pads;
+  std::vector<PVIGEM_TARGET> m_pool;  // allocated, detached targets
+  std::vector<PVIGEM_TARGET> m_abandoned;  // addition timed out, to remove once completed
+  std::map<PVIGEM_TARGET, std::unique_ptr<IndexNotification>> m_index_notifications;
+  static inline PendingAdds s_pending_adds;
+};
+
+/// Wake up on device interface arrivals and removals
+///
+/// Notifications are registered for XUSB (XInput) and HID interfaces.
+/// They are only a hint: XInput may report a change slightly after the notification.
+struct DeviceNotifier {
+  DeviceNotifier() {
+    m_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!m_event) {
+      throw std::runtime_error("CreateEvent() failed");
+    }
+
+    for (auto const& guid : {xusb_interface_guid, hid_interface_guid}) {
+      CM_NOTIFY_FILTER filter;
+      ZeroMemory(&filter, sizeof(filter));
+      filter.cbSize = sizeof(filter);
+      filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+      filter.u.DeviceInterface.ClassGuid = guid;
+      HCMNOTIFICATION notification;
+      auto const ret = CM_Register_Notification(&filter, this, &onNotification, &notification);
+      if (ret == CR_SUCCESS) {
+        m_notifications.push_back(notification);
+      } else {
+        g_logger.warning("CM_Register_Notification() failed: 0x{:X}", ret);
       }
-      std::cout << std::format("  {}", state);
     }
-    std::cout << "\n";
   }
 
-  /// Update plugged pads using `XInputGetState`
-  ///
-  /// Return `true` if state changed.
-  bool updatePlugged() {
-    bool changed = false;
-    for (size_t i = 0; i < m_slots.size(); ++i) {
-      bool plugged = isPadPlugged(i);
-      auto& slot = m_slots[i];
-      // Log state changes and invalid states
-      if (slot.m_managed) {
-        if (!plugged) {
-          std::cerr << std::format("WARNING: virtual pad unplugged on slot {}\n", i + 1);
-        }
-      } else if (slot.m_plugged != plugged) {
-        std::cout << std::format("Pad {} {}\n", i + 1, plugged ? "plugged" : "unplugged");
+  DeviceNotifier(DeviceNotifier const&) = delete;
+  DeviceNotifier& operator=(DeviceNotifier const&) = delete;
+
+  ~DeviceNotifier() {
+    // Unregistering waits for running callbacks, the event can be closed afterwards
+    for (auto const& notification : m_notifications) {
+      CM_Unregister_Notification(notification);
+    }
+    CloseHandle(m_event);
+  }
+
+  /// Return true if at least one notification is registered
+  bool active() const { return !m_notifications.empty(); }
+
+  /// Arrival or removal of an XUSB interface
+  struct Event {
+    bool m_arrival;
+    std::wstring m_link;  // symbolic link of the interface
+    std::chrono::steady_clock::time_point m_time;  // time of the notification
+  };
+
+  /// Return XUSB events received since the last call
+  std::vector<Event> takeEvents() {
+    std::lock_guard lock(m_mutex);
+    return std::exchange(m_events, {});
+  }
+
+  static DWORD CALLBACK onNotification(HCMNOTIFICATION, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA event_data, DWORD) {
+    bool const arrival = action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL;
+    if (arrival || action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) {
+      auto const self = static_cast<DeviceNotifier*>(context);
+      if (IsEqualGUID(event_data->u.DeviceInterface.ClassGuid, xusb_interface_guid)) {
+        std::lock_guard lock(self->m_mutex);
+        self->m_events.push_back({arrival, event_data->u.DeviceInterface.SymbolicLink, std::chrono::steady_clock::now()});
       }
+      SetEvent(self->m_event);
+    }
+    return ERROR_SUCCESS;
+  }
+
+  // GUID_DEVINTERFACE_XUSB, defined in the DDK only
+  static constexpr GUID xusb_interface_guid = {0xEC87F1E3, 0xC13B, 0x4100, {0xB5, 0xF7, 0x8B, 0x84, 0xD5, 0x42, 0x60, 0xCB}};
+  // GUID_DEVINTERFACE_HID
+  static constexpr GUID hid_interface_guid = {0x4D1E55B2, 0xF16F, 0x11CF, {0x88, 0xCB, 0x00, 0x11, 0x11, 0x00, 0x00, 0x30}};
+
+  HANDLE m_event;
+  std::vector<HCMNOTIFICATION> m_notifications;
+  std::mutex m_mutex;  // protect `m_events`, filled from notification threads
+  std::vector<Event> m_events;
+};
 
-      changed |= slot.m_plugged != plugged;
-      slot.m_plugged = plugged;
+/// High-resolution waitable timer
+///
+/// Wake-ups are precise to the sub-millisecond, without raising the timer resolution of the whole system.
+/// Fallback to a regular timer if not supported (before Windows 10 1803).
+struct HighResTimer {
+  using Clock = std::chrono::steady_clock;
+
+  /// Create a timer, its wake-up delays are traced as `trace_phase`
+  explicit HighResTimer(std::string_view trace_phase = "wake-delay"): m_trace_phase(trace_phase) {
+    m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!m_timer) {
+      g_logger.warning("high-resolution timers unavailable, wake-ups will be less precise");
+      m_timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
     }
-    return changed;
+    if (!m_timer) {
+      throw std::runtime_error(std::format("CreateWaitableTimerEx() failed: {}", GetLastError()));
+    }
+  }
+
+  HighResTimer(HighResTimer const&) = delete;
+  HighResTimer& operator=(HighResTimer const&) = delete;
+
+  ~HighResTimer() { CloseHandle(m_timer); }
+
+  /// Sleep until the given time
+  void sleepUntil(Clock::time_point deadline) {
+    waitAny({}, deadline);
   }
 
-  /// Fill all unplugged slots with managed pads
-  void fillAll() {
-    // Count free slots (i.e. how many pads to add)
-    int free = 0;
-    for (auto const& slot : m_slots) {
-      if (!slot.m_plugged) {
-        ++free;
+  /// Wait for one of given objects until the deadline
+  ///
+  /// With `Clock::time_point::max()`, wait without timeout: the thread does not wake up until an object is signaled.
+  /// Return the index of the signaled object, `std::nullopt` on timeout.
+  std::optional<size_t> waitAny(std::initializer_list<HANDLE> objects, Clock::time_point deadline) {
+    bool const timed = deadline != Clock::time_point::max();
+    auto const delay = deadline - Clock::now();
+    if (objects.size() == 0 && (!timed || delay <= Clock::duration::zero())) {
+      return std::nullopt;
+    }
+    if (timed) {
+      // Negative due time is relative, in 100ns units
+      LARGE_INTEGER due;
+      due.QuadPart = -std::max<LONGLONG>(0, std::chrono::duration_cast<std::chrono::duration<LONGLONG, std::ratio<1, 10'000'000>>>(delay).count());
+      if (!SetWaitableTimer(m_timer, &due, 0, nullptr, nullptr, FALSE)) {
+        throw std::runtime_error(std::format("SetWaitableTimer() failed: {}", GetLastError()));
       }
     }
 
-    // `vigem_target_x360_get_user_index()` is unreliable; it sometimes fails.
-    // Assume no new device is manually plugged in between and poll `XInputGetState()`
-    auto const pollNewIndex = [&]() -> size_t {
-      int constexpr timeout_tries = 100;
-      auto constexpr timeout_delay = 1000ms / timeout_tries;
+    std::array<HANDLE, 8> handles;
+    if (objects.size() >= handles.size()) {
+      throw std::logic_error("too many objects to wait for");
+    }
+    ranges::copy(objects, handles.begin());
+    handles[objects.size()] = m_timer;
+    auto const count = static_cast<DWORD>(objects.size() + (timed ? 1 : 0));
+    auto const ret = WaitForMultipleObjects(count, handles.data(), FALSE, INFINITE);
+    if (ret >= WAIT_OBJECT_0 + count) {
+      throw std::runtime_error(std::format("WaitForMultipleObjects() failed: {}", GetLastError()));
+    }
+    auto const index = ret - WAIT_OBJECT_0;
+    if (index == objects.size()) {
+      g_tracer.record(m_trace_phase, deadline);  // scheduling delay
+      return std::nullopt;
+    }
+    if (timed) {
+      CancelWaitableTimer(m_timer);
+    }
+    return index;
+  }
+
+  HANDLE m_timer;
+  std::string_view m_trace_phase;
+};
+
+/// Scheduling settings of the threads handling slots
+struct ThreadSettings {
+  bool m_priority = false;  // raise priority, using MMCSS if available
+  DWORD_PTR m_affinity = 0;  // mask of allowed CPUs; 0 to keep the default
+};
 
-      for (int tries = 0; tries < timeout_tries; ++tries) {
-        for (size_t i = 0; i < m_slots.size(); ++i) {
-          if (m_slots[i].m_plugged) {
-            continue;  // don't poll already plugged slots
-          }
-          if (isPadPlugged(i)) {
-            return i;
-          }
+/// Apply scheduling settings to the current thread, for the lifetime of the object
+///
+/// Failures are not fatal: the thread keeps running with default settings.
+struct ScopedScheduling {
+  explicit ScopedScheduling(ThreadSettings const& settings) {
+    if (settings.m_affinity && !SetThreadAffinityMask(GetCurrentThread(), settings.m_affinity)) {
+      g_logger.warning("SetThreadAffinityMask() failed: {}", GetLastError());
+    }
+    if (settings.m_priority) {
+      DWORD task_index = 0;
+      m_mmcss = AvSetMmThreadCharacteristicsW(L"Games", &task_index);
+      if (!m_mmcss) {
+        g_logger.warning("MMCSS registration failed: {}, fallback to thread priority", GetLastError());
+        if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST)) {
+          g_logger.warning("SetThreadPriority() failed: {}", GetLastError());
         }
-        std::this_thread::sleep_for(timeout_delay);
       }
-      throw std::runtime_error("failed to get index of new virtual pad (timeout)");
-    };
+    }
+  }
 
-    // Create pads for the unplugged slots
-    for (int i = 0; i < free; ++i) {
-      auto pad = m_client.addPad();
-      size_t const index = pollNewIndex();
-      auto& slot = m_slots.at(index);
-      if (slot.m_managed) {
-        std::cerr << std::format("WARNING: virtual pad created on an already managed slot: {}\n", index + 1);
-        m_client.removePad(pad);
-      } else if (slot.m_plugged) {
-        std::cerr << std::format("WARNING: virtual pad created on an already plugged slot: {}\n", index + 1);
-        m_client.removePad(pad);
-      } else {
-        slot.m_plugged = true;
-        slot.m_managed = pad;
+  ScopedScheduling(ScopedScheduling const&) = delete;
+  ScopedScheduling& operator=(ScopedScheduling const&) = delete;
+
+  ~ScopedScheduling() {
+    if (m_mmcss) {
+      AvRevertMmThreadCharacteristics(m_mmcss);
+    }
+  }
+
+  HANDLE m_mmcss = nullptr;
+};
+
+/// Journal of managed slots, kept in a memory-mapped file
+///
+/// If the process is killed, its virtual pads are not removed right away.
+/// The next run reads the journal to recognize them instead of taking them for real pads.
+/// Writes go to the mapped pages and are not flushed: they survive the process, not a system crash.
+/// Failures are not fatal: the journal is just disabled.
+struct SlotJournal {
+  static constexpr uint32_t magic = 0x4c4a5347;  // "GSJL"
+  static constexpr uint32_t version = 1;
+
+  struct Data {
+    uint32_t m_magic;
+    uint32_t m_version;
+    DWORD m_pid;  // owner process, 0 after a clean exit
+    uint64_t m_process_start;  // creation time of the owner, in case its PID is reused
+    std::array<uint8_t, XUSER_MAX_COUNT> m_managed;
+  };
+
+  /// Open the journal, read the previous run, then take ownership
+  SlotJournal() {
+    std::wstring path(MAX_PATH, L'\0');
+    auto const size = GetTempPathW(MAX_PATH, path.data());
+    if (size == 0 || size > MAX_PATH) {
+      g_logger.warning("cannot get journal path, slot journal disabled");
+      return;
+    }
+    path.resize(size);
+    path += file_name;
+    m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+      g_logger.warning("cannot open slot journal: {}", GetLastError());
+      return;
+    }
+    // The file is extended with zeros if needed
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, 0, sizeof(Data), nullptr);
+    if (m_mapping) {
+      m_data = static_cast<Data*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Data)));
+    }
+    if (!m_data) {
+      g_logger.warning("cannot map slot journal: {}", GetLastError());
+      return;
+    }
+
+    if (m_data->m_magic == magic && m_data->m_version == version && m_data->m_pid && !isRunning(m_data->m_pid, m_data->m_process_start)) {
+      for (size_t i = 0; i < m_orphans.size(); ++i) {
+        m_orphans[i] = m_data->m_managed[i];
       }
     }
+    *m_data = {magic, version, GetCurrentProcessId(), processStart(GetCurrentProcess()), {}};
+  }
+
+  SlotJournal(SlotJournal const&) = delete;
+  SlotJournal& operator=(SlotJournal const&) = delete;
+
+  /// Release the journal, virtual pads must have been removed
+  ~SlotJournal() {
+    if (m_data) {
+      m_data->m_pid = 0;
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+      CloseHandle(m_file);
+    }
+  }
+
+  /// Slots managed by a previous run which did not exit cleanly
+  std::array<bool, XUSER_MAX_COUNT> const& orphans() const { return m_orphans; }
 
-    // Check final state
-    updatePlugged();  // will log unplugged managed pads
-    for (size_t i = 0; i < m_slots.size(); ++i) {
-      if (!m_slots[i].m_plugged) {
-        std::cerr << std::format("WARNING: slot {} still unplugged\n", i + 1);
+  /// Record managed slots
+  void save(std::array<bool, XUSER_MAX_COUNT> const& managed) {
+    if (m_data) {
+      for (size_t i = 0; i < managed.size(); ++i) {
+        m_data->m_managed[i] = managed[i];
       }
     }
   }
 
-  /// Free the given slot, if it is managed
-  void freeSlot(size_t index) {
-    if (index >= m_slots.size()) {
-      std::cerr << std::format("ERROR: invalid slot: {}\n", index + 1);
+ private:
+  static constexpr wchar_t const* file_name = L"gamepad-slotter.journal";
+
+  /// Return the creation time of a process, 0 if unknown
+  static uint64_t processStart(HANDLE process) {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(process, &creation, &exit, &kernel, &user)) {
+      return 0;
     }
-    auto& slot = m_slots.at(index);
-    if (!slot.m_managed) {
-      std::cerr << std::format("ERROR: cannot free unmanaged slot: {}\n", index + 1);
-      return;
+    return (static_cast<uint64_t>(creation.dwHighDateTime) << 32) | creation.dwLowDateTime;
+  }
+
+  /// Return `true` if the given process is still running
+  static bool isRunning(DWORD pid, uint64_t start) {
+    auto const process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process) {
+      return false;
     }
+    DWORD code;
+    bool const running = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE && processStart(process) == start;
+    CloseHandle(process);
+    return running;
+  }
+
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+  Data* m_data = nullptr;
+  std::array<bool, XUSER_MAX_COUNT> m_orphans{};
+};
 
-    m_client.removePad(slot.m_managed);
-    slot.m_managed = nullptr;
+/// XInput functions, loaded at runtime
+///
+/// XInput 1.4 ships with Windows 8 and later; older versions are used as fallbacks.
+/// Connection is checked with `XInputGetCapabilities()`, which does not need the input state.
+struct XInputLibrary {
+  using GetCapabilities = DWORD(WINAPI*)(DWORD, DWORD, XINPUT_CAPABILITIES*);
+  using GetState = DWORD(WINAPI*)(DWORD, XINPUT_STATE*);
 
-    // Wait for pad to be actually unplugged
-    int constexpr timeout_tries = 100;
-    auto constexpr timeout_delay = 1000ms / timeout_tries;
-    for (int tries = 0; tries < timeout_tries; ++tries) {
-      slot.m_plugged = isPadPlugged(index);
-      if (!slot.m_plugged) {
+  XInputLibrary() {
+    for (auto const name : {L"xinput1_4.dll", L"xinput1_3.dll", L"xinput9_1_0.dll"}) {
+      m_module = LoadLibraryExW(name, nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+      if (m_module) {
         break;
       }
-      std::this_thread::sleep_for(timeout_delay);
     }
-    if (slot.m_plugged) {
-      std::cerr << std::format("WARNING: managed slot {} has been freed but is still plugged\n", index + 1);
+    if (!m_module) {
+      throw std::runtime_error(std::format("cannot load XInput: {}", GetLastError()));
+    }
+    m_get_capabilities = reinterpret_cast<GetCapabilities>(reinterpret_cast<void*>(GetProcAddress(m_module, "XInputGetCapabilities")));
+    m_get_state = reinterpret_cast<GetState>(reinterpret_cast<void*>(GetProcAddress(m_module, "XInputGetState")));
+    if (!m_get_capabilities && !m_get_state) {
+      throw std::runtime_error("XInput functions not found");
     }
   }
 
-  /// Fill all slots except the given one
-  ///
-  /// Do nothing if state is already fine.
-  void fillAllButOne(size_t index) {
-    for (size_t i = 0; i < m_slots.size(); ++i) {
-      if (i != index && !m_slots[i].m_plugged) {
-        fillAll();
-        freeSlot(index);
-      }
+  XInputLibrary(XInputLibrary const&) = delete;
+  XInputLibrary& operator=(XInputLibrary const&) = delete;
+
+  ~XInputLibrary() { FreeLibrary(m_module); }
+
+  /// Return the library, load it on first use
+  static XInputLibrary const& get() {
+    static XInputLibrary const library;
+    return library;
+  }
+
+  /// Return `true` if a pad is connected on given slot
+  bool isConnected(DWORD index) const {
+    if (m_get_capabilities) {
+      XINPUT_CAPABILITIES capabilities;
+      return m_get_capabilities(index, 0, &capabilities) == ERROR_SUCCESS;
     }
-    // Nothing to do
+    XINPUT_STATE state;
+    ZeroMemory(&state, sizeof(XINPUT_STATE));
+    return m_get_state(index, &state) == ERROR_SUCCESS;
   }
 
+  HMODULE m_module = nullptr;
+  GetCapabilities m_get_capabilities = nullptr;
+  GetState m_get_state = nullptr;
+};
+
+/// XInput and ViGEm backend of `ConnectedPads`
+struct SystemBackend: VigemClient {
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t slot_count = XUSER_MAX_COUNT;
+
   /// Get state of a single slot
   static bool isPadPlugged(size_t index) {
-    XINPUT_STATE state;
-    ZeroMemory(&state, sizeof(XINPUT_STATE));
-    return XInputGetState(index, &state) == ERROR_SUCCESS;
+    return XInputLibrary::get().isConnected(static_cast<DWORD>(index));
+  }
+
+  /// Probe all slots concurrently, one thread per slot
+  static std::array<bool, slot_count> probeAll() {
+    XInputLibrary::get();  // load from this thread, so that failures are reported
+    std::array<bool, slot_count> plugged;
+    std::array<std::thread, slot_count - 1> threads;
+    for (size_t i = 0; i < threads.size(); ++i) {
+      threads[i] = std::thread([&plugged, i] { plugged[i + 1] = isPadPlugged(i + 1); });
+    }
+    plugged[0] = isPadPlugged(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return plugged;
+  }
+
+  static Clock::time_point now() { return Clock::now(); }
+
+  void saveManaged(std::array<bool, slot_count> const& managed) {
+    if (m_journal) {
+      m_journal->save(managed);
+    }
+  }
+
+  /// Sleep until the given time, or until `m_wake_event` is signaled
+  void sleepUntil(Clock::time_point deadline) {
+    if (m_wake_event) {
+      m_timer.waitAny({m_wake_event}, deadline);
+    } else {
+      m_timer.sleepUntil(deadline);
+    }
   }
 
-  VigemClient m_client;
-  std::array<Slot, XUSER_MAX_COUNT> m_slots;
+  HighResTimer m_timer;
+  HANDLE m_wake_event = nullptr;  // interrupt waits, e.g. on device changes
+  SlotJournal* m_journal = nullptr;
 };
 
+using Pads = ConnectedPads<SystemBackend>;
 
-int main(int argc, char* argv[]) {
-  size_t target = SIZE_MAX;  // invalid, checked to display usage
-  if (argc < 2) {
-    target = 0;  // default: wait for first slot
-  } else if (argc == 2) {
-    // Parse a 1-character index
-    if (std::strlen(argv[1]) == 1) {
-      char c = argv[1][0];
-      if (c >= '1' && c < '1' + XUSER_MAX_COUNT) {
-        target = c - '1';
-      }
+
+/// Watch slots from a dedicated thread
+///
+/// Slots are probed on device notifications, and periodically as a fallback.
+/// Changes are queued as timestamped events, so that they are not missed while the main thread fills slots.
+struct SlotWatcher {
+  using Clock = SystemBackend::Clock;
+
+  struct SlotEvent {
+    Clock::time_point m_time;
+    size_t m_slot;
+    bool m_plugged;
+  };
+
+  static constexpr auto fast_poll_delay = 10ms;
+  static constexpr auto fast_poll_duration = 500ms;  // after a notification, XInput may lag behind it
+
+  /// Start watching, slots are polled every `poll_interval`
+  ///
+  /// By default, poll rarely if notifications are available, just to catch missed ones.
+  SlotWatcher(std::optional<Clock::duration> poll_interval, ThreadSettings const& scheduling): m_scheduling(scheduling) {
+    m_poll_delay = poll_interval.value_or(m_notifier.active() ? Clock::duration(5s) : Clock::duration(100ms));
+    m_ready = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    m_wake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    m_stop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!m_ready || !m_wake || !m_stop) {
+      throw std::runtime_error("CreateEvent() failed");
     }
+    m_thread = std::thread([this] { run(); });
   }
-  if (target == SIZE_MAX) {
-    std::cerr << std::format("usage: {} [1-{}]\n", argv[0], XUSER_MAX_COUNT);
-    return EXIT_FAILURE;
+
+  SlotWatcher(SlotWatcher const&) = delete;
+  SlotWatcher& operator=(SlotWatcher const&) = delete;
+
+  ~SlotWatcher() {
+    SetEvent(m_stop);
+    m_thread.join();
+    CloseHandle(m_ready);
+    CloseHandle(m_wake);
+    CloseHandle(m_stop);
   }
 
-  try {
-    ConnectedPads pads;
-    pads.printState();
+  /// Return true if device notifications are available
+  bool active() const { return m_notifier.active(); }
+
+  /// Event signaled when slot events are queued, or a device notification is received
+  HANDLE event() const { return m_ready; }
 
-    if (pads.isPlugged(target)) {
-      std::cout << std::format("Pad {} already plugged\n", target + 1);
-      return EXIT_SUCCESS;
+  /// Same as `event()`, for the waits of the backend
+  ///
+  /// Another event is needed, so that the main loop does not miss events.
+  HANDLE wakeEvent() const { return m_wake; }
+
+  /// Return XUSB events received since the last call
+  std::vector<DeviceNotifier::Event> takeDeviceEvents() { return m_notifier.takeEvents(); }
+
+  /// Apply queued events to pads, return `true` if state changed
+  ///
+  /// Rethrow the error which stopped the watcher thread, if any.
+  bool apply(Pads& pads) {
+    if (m_failed.load(std::memory_order_acquire)) {
+      std::rethrow_exception(m_error);
     }
+    bool changed = false;
+    if (m_overflow.exchange(false)) {
+      g_logger.warning("slot events lost, probing all slots");
+      changed = pads.pollChange(0ms);
+    }
+    while (auto const event = m_events.pop()) {
+      if (pads.applyPlugged(event->m_slot, event->m_plugged, event->m_time)) {
+        // Include the time spent in the queue
+        g_tracer.record(event->m_plugged ? "plugged" : "unplugged", event->m_time, event->m_slot);
+        changed = true;
+      }
+    }
+    return changed;
+  }
 
-    pads.fillAllButOne(target);
-    std::cout << std::format("Waiting pad on slot {}...\n", target + 1);
-    pads.printState();
-    for (;;) {
-      std::this_thread::sleep_for(100ms);
-      if (pads.updatePlugged()) {
-        if (pads.isPlugged(target)) {
-          break;
+ private:
+  /// Probe a single slot, record the result
+  static bool probe(size_t index) {
+    if (!g_recorder.m_enabled) {
+      return SystemBackend::isPadPlugged(index);
+    }
+    auto const start = SystemBackend::now();
+    bool const plugged = SystemBackend::isPadPlugged(index);
+    g_recorder.record(RecordKind::Probe, start.time_since_epoch(), SystemBackend::now() - start, index, plugged);
+    return plugged;
+  }
+
+  void run() {
+    try {
+      ScopedScheduling const scheduling(m_scheduling);
+      HighResTimer timer("watcher-wake-delay");
+      ProbeScheduler<Clock, SystemBackend::slot_count> probes;
+      std::array<bool, SystemBackend::slot_count> plugged;
+
+      // Report the initial state, the main thread ignores it if its own state is more recent
+      auto now = Clock::now();
+      for (size_t i = 0; i < plugged.size(); ++i) {
+        plugged[i] = probe(i);
+        push({now, i, plugged[i]});
+      }
+      signal();
+
+      auto fast_until = Clock::time_point::min();
+      for (auto next = now + m_poll_delay; ; ) {
+        auto const signaled = timer.waitAny({m_stop, m_notifier.m_event}, next);
+        now = Clock::now();
+        if (signaled == 0) {
+          return;
+        }
+        bool const notified = signaled == 1;
+        if (notified) {
+          probes.reset();
+          fast_until = now + fast_poll_duration;
+        }
+
+        // `plugged` ignores changes made by the main thread, a quick swap on a slot may go unnoticed.
+        // After a notification, report all probes; outdated ones are ignored by `apply()`.
+        bool const report_all = now < fast_until;
+        bool queued = false;
+        for (size_t i = 0; i < plugged.size(); ++i) {
+          if (!probes.isDue(i, now)) {
+            continue;
+          }
+          now = Clock::now();
+          bool const state = probe(i);
+          probes.probed(i, now, state, state != plugged[i]);
+          if (state != plugged[i] || report_all) {
+            plugged[i] = state;
+            push({now, i, state});
+            queued = true;
+          }
+        }
+        if (queued || notified) {
+          signal();
         }
-        // Fill again, in case an unmanaged gamepad has been unplugged
-        pads.fillAllButOne(target);
-        pads.printState();
+        next = now + (now < fast_until ? Clock::duration(fast_poll_delay) : m_poll_delay);
       }
+    } catch (...) {
+      // Reported to the main thread by `apply()`
+      m_error = std::current_exception();
+      m_failed.store(true, std::memory_order_release);
+      signal();
     }
-  } catch (std::exception const& e) {
-    std::cerr << "FATAL: " << e.what() << "\n";
-    return EXIT_FAILURE;
   }
+
+  void signal() {
+    SetEvent(m_ready);
+    SetEvent(m_wake);
+  }
+
+  void push(SlotEvent const& event) {
+    if (!m_events.push(event)) {
+      m_overflow = true;
+    }
+  }
+
+  DeviceNotifier m_notifier;
+  ThreadSettings m_scheduling;
+  Clock::duration m_poll_delay;
+  HANDLE m_ready;
+  HANDLE m_wake;
+  HANDLE m_stop;
+  SpscQueue<SlotEvent, 256> m_events;  // fits all probes reported while the main thread fills slots
+  std::atomic<bool> m_overflow = false;  // events have been dropped
+  std::exception_ptr m_error;  // set by the watcher thread, before `m_failed`
+  std::atomic<bool> m_failed = false;
+  std::thread m_thread;
+};
+
+
+/// Parse a 1-character slot index (from 1 to `XUSER_MAX_COUNT`)
+std::optional<size_t> parseSlot(std::string_view arg) {
+  if (arg.size() == 1) {
+    char c = arg[0];
+    if (c >= '1' && c < '1' + XUSER_MAX_COUNT) {
+      return c - '1';
+    }
+  }
+  return std::nullopt;
+}
+
+/// Parse a strictly positive integer
+std::optional<unsigned int> parsePositive(std::string_view arg) {
+  unsigned int value;
+  auto const [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+  if (ec != std::errc() || end != arg.data() + arg.size() || value == 0) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+/// Parse a space-separated list of distinct slot indexes
+std::optional<std::vector<size_t>> parseSlots(std::string_view args) {
+  std::vector<size_t> slots;
+  while (!args.empty()) {
+    auto const end = args.find(' ');
+    auto const arg = args.substr(0, end);
+    args.remove_prefix(end == args.npos ? args.size() : end + 1);
+    if (arg.empty()) {
+      continue;
+    }
+    auto const slot = parseSlot(arg);
+    if (!slot || ranges::find(slots, *slot) != slots.end()) {
+      return std::nullopt;
+    }
+    slots.push_back(*slot);
+  }
+  if (slots.empty()) {
+    return std::nullopt;
+  }
+  return slots;
+}
+
+/// Format slot indexes, each one prefixed by a space
+std::string formatSlots(std::vector<size_t> const& slots) {
+  std::string out;
+  for (auto const slot : slots) {
+    out += std::format(" {}", slot + 1);
+  }
+  return out;
 }
 
+/// Hardware identity of a physical device
+struct DeviceIdentity {
+  std::optional<uint16_t> m_vid;
+  std::optional<uint16_t> m_pid;
+  std::string m_container;  // container ID, lowercase with braces; empty if unknown
+  bool m_virtual = false;  // created by ViGEmBus
+};
+
+/// Lookup of XUSB device identities, through SetupAPI
+///
+/// Devices are queried on arrival, from the symbolic link of their interface.
+struct DeviceLookup {
+  /// Return the identity of an arrived device
+  std::optional<DeviceIdentity> identify(std::wstring_view link) {
+    auto const set = SetupDiCreateDeviceInfoList(&DeviceNotifier::xusb_interface_guid, nullptr);
+    if (set == INVALID_HANDLE_VALUE) {
+      return std::nullopt;
+    }
+    std::optional<DeviceIdentity> device;
+    SP_DEVICE_INTERFACE_DATA interface_data;
+    interface_data.cbSize = sizeof(interface_data);
+    if (SetupDiOpenDeviceInterfaceW(set, std::wstring(link).c_str(), 0, &interface_data)) {
+      device = readInterface(set, interface_data);
+    }
+    SetupDiDestroyDeviceInfoList(set);
+    return device;
+  }
+
+ private:
+  /// Read the identity of an interface's device
+  static std::optional<DeviceIdentity> readInterface(HDEVINFO set, SP_DEVICE_INTERFACE_DATA& interface_data) {
+    alignas(SP_DEVICE_INTERFACE_DETAIL_DATA_W) BYTE buffer[1024];
+    auto const detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA_W>(buffer);
+    detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
+    SP_DEVINFO_DATA info;
+    info.cbSize = sizeof(info);
+    if (!SetupDiGetDeviceInterfaceDetailW(set, &interface_data, detail, sizeof(buffer), nullptr, &info)) {
+      return std::nullopt;
+    }
+
+    DeviceIdentity device;
+    auto const hardware_id = readProperty(set, info, SPDRP_HARDWAREID);
+    device.m_vid = parseIdField(hardware_id, L"VID");
+    device.m_pid = parseIdField(hardware_id, L"PID");
+    for (auto const c : readProperty(set, info, SPDRP_BASE_CONTAINERID)) {
+      device.m_container += static_cast<char>(std::towlower(c));  // GUIDs are ASCII
+    }
+
+    // Virtual pads are children of the ViGEmBus device
+    DEVINST parent;
+    wchar_t parent_id[256] = {};
+    ULONG size = sizeof(parent_id) - sizeof(wchar_t);
+    if (CM_Get_Parent(&parent, info.DevInst, 0) == CR_SUCCESS &&
+        CM_Get_DevNode_Registry_PropertyW(parent, CM_DRP_HARDWAREID, nullptr, parent_id, &size, 0) == CR_SUCCESS) {
+      device.m_virtual = std::wstring_view(parent_id).find(L"ViGEmBus") != std::wstring_view::npos;
+    }
+
+    return device;
+  }
+
+  /// Read a string property, only the first string of multi-strings
+  static std::wstring readProperty(HDEVINFO set, SP_DEVINFO_DATA& info, DWORD property) {
+    wchar_t buffer[256] = {};
+    if (!SetupDiGetDeviceRegistryPropertyW(set, &info, property, nullptr, reinterpret_cast<BYTE*>(buffer), sizeof(buffer) - sizeof(wchar_t), nullptr)) {
+      return {};
+    }
+    return buffer;
+  }
+
+  /// Parse an hexadecimal field of a hardware ID
+  ///
+  /// Handle USB (`VID_045E`) and Bluetooth (`VID&0002045E`) formats.
+  static std::optional<uint16_t> parseIdField(std::wstring_view id, std::wstring_view key) {
+    for (auto pos = id.find(key); pos != id.npos; pos = id.find(key, pos + 1)) {
+      auto const start = pos + key.size() + 1;
+      if (start > id.size() || (id[start - 1] != L'_' && id[start - 1] != L'&')) {
+        continue;
+      }
+      size_t digits = 0;
+      while (start + digits < id.size() && digits < 8 && std::iswxdigit(id[start + digits])) {
+        ++digits;
+      }
+      if (digits == 4 || digits == 8) {
+        auto const value = std::wcstoul(std::wstring(id.substr(start, digits)).c_str(), nullptr, 16);
+        return static_cast<uint16_t>(value & 0xFFFF);
+      }
+    }
+    return std::nullopt;
+  }
+};
+
+/// Physical device routed to a slot
+struct DeviceRule {
+  std::optional<uint16_t> m_vid;
+  std::optional<uint16_t> m_pid;
+  std::string m_container;  // lowercase with braces; used instead of VID/PID if set
+
+  bool matches(DeviceIdentity const& device) const {
+    if (device.m_virtual) {
+      return false;
+    }
+    if (!m_container.empty()) {
+      return device.m_container == m_container;
+    }
+    return device.m_vid == m_vid && device.m_pid == m_pid;
+  }
+
+  /// Parse `SLOT=VID:PID` or `SLOT={CONTAINER-ID}`
+  static std::optional<std::pair<size_t, DeviceRule>> parse(std::string_view arg) {
+    auto const sep = arg.find('=');
+    if (sep == arg.npos) {
+      return std::nullopt;
+    }
+    auto const slot = parseSlot(arg.substr(0, sep));
+    auto const value = arg.substr(sep + 1);
+    if (!slot) {
+      return std::nullopt;
+    }
+
+    DeviceRule rule;
+    if (value.size() == 38 && value.front() == '{' && value.back() == '}') {
+      for (auto const c : value) {
+        rule.m_container += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      }
+      return std::pair{*slot, rule};
+    }
+
+    auto const parseHex = [](std::string_view s) -> std::optional<uint16_t> {
+      uint16_t out;
+      auto const [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out, 16);
+      if (s.size() != 4 || ec != std::errc() || end != s.data() + s.size()) {
+        return std::nullopt;
+      }
+      return out;
+    };
+    if (value.size() != 9 || value[4] != ':') {
+      return std::nullopt;
+    }
+    rule.m_vid = parseHex(value.substr(0, 4));
+    rule.m_pid = parseHex(value.substr(5));
+    if (!rule.m_vid || !rule.m_pid) {
+      return std::nullopt;
+    }
+    return std::pair{*slot, rule};
+  }
+};
+
+/// Keep target slots reserved until the device routed to them arrives
+///
+/// A target with a rule is filled too, so that no other device takes it.
+/// Once a matching device arrives, the target is freed for it.
+/// In just-in-time mode, all targets are filled and any physical device matches.
+struct DeviceRouter {
+  DeviceRouter(std::map<size_t, DeviceRule> const& rules, bool jit): m_rules(rules), m_jit(jit) {}
+
+  /// Return `true` if some targets are reserved until a device arrives
+  bool enabled() const { return m_jit || !m_rules.empty(); }
+
+  /// Return `true` if the given target waits for a device arrival
+  bool isRouted(size_t target) const { return m_jit || m_rules.contains(target); }
+
+  /// Return `true` if a device can take the given target
+  bool matches(size_t target, DeviceIdentity const& device) const {
+    if (auto const it = m_rules.find(target); it != m_rules.end()) {
+      return it->second.matches(device);
+    }
+    return m_jit && !device.m_virtual;
+  }
+
+  /// Fill slots so that only the given target can be taken, by a matching device if required
+  void fillSlots(Pads& pads, size_t target) {
+    if (m_open && *m_open != target) {
+      m_open.reset();
+      m_arrived_at.reset();
+    }
+    if (isRouted(target) && !m_open) {
+      Pads::Layout layout;
+      layout.fill(Pads::SlotGoal::Reserved);
+      pads.reconcile(layout);
+    } else {
+      pads.fillAllButOne(target);
+    }
+  }
+
+  /// Identify arrived devices, free the target for a matching one
+  ///
+  /// Return `true` if the target has been freed.
+  bool handleEvents(Pads& pads, std::optional<size_t> target, std::vector<DeviceNotifier::Event> const& events) {
+    if (!enabled()) {
+      return false;
+    }
+    bool opened = false;
+    for (auto const& event : events) {
+      if (!event.m_arrival) {
+        continue;
+      }
+      auto const device = m_lookup.identify(event.m_link);
+      if (!device || !target || m_open == target) {
+        continue;
+      }
+      if (matches(*target, *device)) {
+        g_logger.info("Matching device arrived, freeing slot {}", *target + 1);
+        m_open = target;
+        m_open_until = SystemBackend::now() + open_timeout;
+        m_arrived_at = event.m_time;
+        if (pads.m_slots[*target].m_managed) {
+          pads.freeSlot(*target);
+        }
+        // The slot must be freed before the device is assigned one
+        g_tracer.record("arrival-to-free", event.m_time, *target);
+        // The device takes the slot as soon as it is freed, slot events may not report it
+        pads.waitRealPad(*target, open_timeout);
+        opened = true;
+      }
+    }
+    return opened;
+  }
+
+  /// Trace the time from the arrival of a matching device to its assignment to the freed target
+  void traceLanding(Pads const& pads) {
+    if (m_open && m_arrived_at && pads.hasRealPad(*m_open)) {
+      g_tracer.record("arrival-to-slot", *m_arrived_at, *m_open);
+      m_arrived_at.reset();
+    }
+  }
+
+  /// Return the time at which `checkExpired()` has to be called, `time_point::max()` if none
+  SystemBackend::Clock::time_point deadline() const {
+    return m_open ? m_open_until : SystemBackend::Clock::time_point::max();
+  }
+
+  /// Reserve the target again if the matching device did not take it in time
+  ///
+  /// The target is probed first: its state may be outdated.
+  /// Return `true` if the target has to be checked again, and filled if still free.
+  bool checkExpired(Pads& pads) {
+    if (!m_open || SystemBackend::now() < m_open_until) {
+      return false;
+    }
+    auto const open = *m_open;
+    m_open.reset();
+    m_arrived_at.reset();
+    pads.updateSlot(open);
+    if (!pads.hasRealPad(open)) {
+      g_logger.warning("matching device did not take slot {}, reserving it again", open + 1);
+    }
+    return true;
+  }
+
+  static constexpr auto open_timeout = 2000ms;
+
+  std::map<size_t, DeviceRule> m_rules;
+  bool m_jit;
+  DeviceLookup m_lookup;
+  std::optional<size_t> m_open;  // target freed for a matching device
+  SystemBackend::Clock::time_point m_open_until;
+  std::optional<SystemBackend::Clock::time_point> m_arrived_at;  // arrival of the device, until it is assigned
+};
+
+/// Named layout of the daemon, switched with the `profile` command
+struct Profile {
+  std::string m_name;
+  std::vector<size_t> m_targets;
+  std::optional<std::chrono::milliseconds> m_index_timeout;
+  std::optional<std::chrono::milliseconds> m_free_timeout;
+  std::optional<std::chrono::milliseconds> m_add_timeout;
+
+  /// Return timeouts of the profile, using `defaults` for unset ones
+  Pads::Timeouts timeouts(Pads::Timeouts const& defaults) const {
+    auto timeouts = defaults;
+    if (m_index_timeout) {
+      timeouts.m_index = *m_index_timeout;
+    }
+    if (m_free_timeout) {
+      timeouts.m_free = *m_free_timeout;
+    }
+    if (m_add_timeout) {
+      timeouts.m_add = *m_add_timeout;
+    }
+    return timeouts;
+  }
+
+  /// Parse `NAME: SLOT... [index-timeout=MS] [free-timeout=MS] [add-timeout=MS]`
+  static std::optional<Profile> parse(std::string_view line) {
+    auto const sep = line.find(':');
+    if (sep == line.npos) {
+      return std::nullopt;
+    }
+    Profile profile;
+    profile.m_name = line.substr(0, sep);
+    if (profile.m_name.empty() || profile.m_name.find(' ') != std::string::npos) {
+      return std::nullopt;
+    }
+
+    std::string slots;
+    auto args = line.substr(sep + 1);
+    while (!args.empty()) {
+      auto const end = args.find(' ');
+      auto const arg = args.substr(0, end);
+      args.remove_prefix(end == args.npos ? args.size() : end + 1);
+      if (arg.empty()) {
+        continue;
+      }
+      auto const eq = arg.find('=');
+      if (eq == arg.npos) {
+        slots += std::format("{} ", arg);
+        continue;
+      }
+      auto const key = arg.substr(0, eq);
+      auto const ms = parsePositive(arg.substr(eq + 1));
+      if (!ms) {
+        return std::nullopt;
+      } else if (key == "index-timeout") {
+        profile.m_index_timeout = std::chrono::milliseconds(*ms);
+      } else if (key == "free-timeout") {
+        profile.m_free_timeout = std::chrono::milliseconds(*ms);
+      } else if (key == "add-timeout") {
+        profile.m_add_timeout = std::chrono::milliseconds(*ms);
+      } else {
+        return std::nullopt;
+      }
+    }
+    auto targets = parseSlots(slots);
+    if (!targets) {
+      return std::nullopt;
+    }
+    profile.m_targets = std::move(*targets);
+    return profile;
+  }
+
+  /// Load profiles from a file, one per line
+  ///
+  /// Empty lines and lines starting with `#` are ignored.
+  static std::vector<Profile> load(std::string const& path) {
+    std::ifstream in(path);
+    if (!in) {
+      throw std::runtime_error(std::format("cannot open profile file: {}", path));
+    }
+    std::vector<Profile> profiles;
+    std::string line;
+    for (size_t line_number = 1; std::getline(in, line); ++line_number) {
+      while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) {
+        line.pop_back();
+      }
+      if (line.empty() || line.front() == '#') {
+        continue;
+      }
+      auto profile = parse(line);
+      if (!profile) {
+        throw std::runtime_error(std::format("invalid profile, {} line {}", path, line_number));
+      }
+      if (ranges::find(profiles, profile->m_name, &Profile::m_name) != profiles.end()) {
+        throw std::runtime_error(std::format("duplicate profile '{}', {} line {}", profile->m_name, path, line_number));
+      }
+      profiles.push_back(std::move(*profile));
+    }
+    return profiles;
+  }
+};
+
+/// How virtual pads are removed once the target is reached
+struct ReleasePolicy {
+  enum class Mode {
+    All,  // remove all pads at once, on exit
+    Keep,  // keep pads until interrupted
+    Paced,  // remove pads one by one
+    OnExit,  // wait for a process to exit, then remove all pads
+  };
+
+  Mode m_mode = Mode::All;
+  std::chrono::milliseconds m_pace{};  // delay between removals, in paced mode
+  std::wstring m_process;  // executable name, lowercase
+
+  /// Parse `all`, `keep`, `paced=MS` or `on-exit=PROCESS.EXE`
+  static std::optional<ReleasePolicy> parse(std::string_view arg) {
+    ReleasePolicy policy;
+    if (arg == "all") {
+      policy.m_mode = Mode::All;
+    } else if (arg == "keep") {
+      policy.m_mode = Mode::Keep;
+    } else if (arg.starts_with("paced=")) {
+      auto const ms = parsePositive(arg.substr(6));
+      if (!ms) {
+        return std::nullopt;
+      }
+      policy.m_mode = Mode::Paced;
+      policy.m_pace = std::chrono::milliseconds(*ms);
+    } else if (arg.starts_with("on-exit=") && arg.size() > 8) {
+      auto const name = arg.substr(8);
+      auto const size = MultiByteToWideChar(CP_UTF8, 0, name.data(), static_cast<int>(name.size()), nullptr, 0);
+      if (size <= 0) {
+        return std::nullopt;
+      }
+      policy.m_process.resize(size);
+      MultiByteToWideChar(CP_UTF8, 0, name.data(), static_cast<int>(name.size()), policy.m_process.data(), size);
+      ranges::transform(policy.m_process, policy.m_process.begin(), [](wchar_t c) { return std::towlower(c); });
+      policy.m_mode = Mode::OnExit;
+    } else {
+      return std::nullopt;
+    }
+    return policy;
+  }
+};
+
+/// Command line options
+struct Options {
+  std::vector<size_t> m_targets = {0};  // slots to fill, in order; default: wait for first slot
+  bool m_daemon = false;
+  bool m_warm_up = false;  // preallocate virtual pads
+  bool m_trace = false;  // print a latency summary at exit
+  std::string m_trace_csv;  // write trace records to this file
+  std::string m_record;  // write slot events to this file, for replay
+  bool m_quiet = false;  // only log warnings and errors
+  std::string m_log_file;  // write logs to this file instead of the console
+  std::string m_command;  // command to send to the daemon
+  std::map<size_t, DeviceRule> m_rules;  // devices routed to slots
+  std::optional<std::chrono::milliseconds> m_poll_interval;  // fallback polling of slots
+  Pads::Timeouts m_timeouts;
+  ThreadSettings m_scheduling;
+  bool m_jit = false;  // fill targets too, free them on device arrival
+  bool m_guard = false;  // keep virtual pads once target pads are plugged
+  std::optional<std::chrono::seconds> m_release_after;  // in guard mode, stop after this quiet period
+  std::string m_profiles;  // file of daemon profiles
+  ReleasePolicy m_release;  // removal of virtual pads, once the target is reached
+
+  /// Parse options, return `std::nullopt` on error
+  static std::optional<Options> parse(int argc, char* argv[]) {
+    Options options;
+    std::string targets;
+    for (int i = 1; i < argc; ++i) {
+      std::string_view const arg = argv[i];
+      if (arg == "--daemon") {
+        options.m_daemon = true;
+      } else if (arg == "--warm-up") {
+        options.m_warm_up = true;
+      } else if (arg == "--release") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        auto const policy = ReleasePolicy::parse(argv[i]);
+        if (!policy) {
+          return std::nullopt;
+        }
+        options.m_release = *policy;
+      } else if (arg == "--profiles") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        options.m_profiles = argv[i];
+      } else if (arg == "--jit") {
+        options.m_jit = true;
+      } else if (arg == "--index-timeout" || arg == "--free-timeout" || arg == "--add-timeout") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        auto const ms = parsePositive(argv[i]);
+        if (!ms) {
+          return std::nullopt;
+        }
+        auto& timeout = arg == "--index-timeout" ? options.m_timeouts.m_index
+                        : arg == "--free-timeout" ? options.m_timeouts.m_free
+                        : options.m_timeouts.m_add;
+        timeout = std::chrono::milliseconds(*ms);
+      } else if (arg == "--priority") {
+        options.m_scheduling.m_priority = true;
+      } else if (arg == "--affinity") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        std::string_view value = argv[i];
+        if (value.starts_with("0x")) {
+          value.remove_prefix(2);
+        }
+        DWORD_PTR mask;
+        auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), mask, 16);
+        if (ec != std::errc() || end != value.data() + value.size() || mask == 0) {
+          return std::nullopt;
+        }
+        options.m_scheduling.m_affinity = mask;
+      } else if (arg == "--guard") {
+        options.m_guard = true;
+      } else if (arg == "--release-after") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        auto const seconds = parsePositive(argv[i]);
+        if (!seconds) {
+          return std::nullopt;
+        }
+        options.m_release_after = std::chrono::seconds(*seconds);
+      } else if (arg == "--quiet") {
+        options.m_quiet = true;
+      } else if (arg == "--log-file") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        options.m_log_file = argv[i];
+      } else if (arg == "--poll-interval") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        auto const ms = parsePositive(argv[i]);
+        if (!ms) {
+          return std::nullopt;
+        }
+        options.m_poll_interval = std::chrono::milliseconds(*ms);
+      } else if (arg == "--trace") {
+        options.m_trace = true;
+      } else if (arg == "--trace-csv") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        options.m_trace = true;
+        options.m_trace_csv = argv[i];
+      } else if (arg == "--record") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        options.m_record = argv[i];
+      } else if (arg == "--match") {
+        if (++i == argc) {
+          return std::nullopt;
+        }
+        auto const rule = DeviceRule::parse(argv[i]);
+        if (!rule || !options.m_rules.insert(*rule).second) {
+          return std::nullopt;
+        }
+      } else if (arg == "--send") {
+        // Remaining arguments are the command
+        for (++i; i < argc; ++i) {
+          options.m_command += options.m_command.empty() ? "" : " ";
+          options.m_command += argv[i];
+        }
+        if (options.m_command.empty()) {
+          return std::nullopt;
+        }
+      } else if (arg.starts_with("-")) {
+        return std::nullopt;
+      } else {
+        targets += std::format("{} ", arg);
+      }
+    }
+    if (!targets.empty()) {
+      auto slots = parseSlots(targets);
+      if (!slots || options.m_daemon || !options.m_command.empty()) {
+        return std::nullopt;
+      }
+      options.m_targets = std::move(*slots);
+    }
+    if (options.m_daemon && !options.m_command.empty()) {
+      return std::nullopt;
+    }
+    if ((options.m_guard && options.m_daemon) || (options.m_release_after && !options.m_guard) ||
+        (!options.m_profiles.empty() && !options.m_daemon) ||
+        (options.m_release.m_mode != ReleasePolicy::Mode::All && options.m_daemon)) {
+      return std::nullopt;
+    }
+    return options;
+  }
+
+  static void printUsage(char const* argv0) {
+    std::cerr << std::format("usage: {} [OPTIONS] [1-{}]...\n", argv0, XUSER_MAX_COUNT);
+    std::cerr << std::format("       {} --daemon [OPTIONS]\n", argv0);
+    std::cerr << std::format("       {} --send COMMAND...\n", argv0);
+    std::cerr << "\n";
+    std::cerr << "options:\n";
+    std::cerr << "  --warm-up           preallocate virtual pads\n";
+    std::cerr << "  --profiles FILE     with --daemon, load layout profiles from FILE\n";
+    std::cerr << "  --jit               fill target slots too, free them when a controller arrives\n";
+    std::cerr << "  --guard             keep slots reserved once pads are plugged, until interrupted\n";
+    std::cerr << "  --release-after S   with --guard, stop after S seconds without change\n";
+    std::cerr << "  --release POLICY    once done, remove virtual pads: all (default), keep (until interrupted),\n";
+    std::cerr << "                      paced=MS (one by one, MS milliseconds apart) or on-exit=PROCESS.EXE\n";
+    std::cerr << "  --match N=DEVICE    keep slot N for DEVICE, given as VID:PID or {CONTAINER-ID}\n";
+    std::cerr << "  --poll-interval MS  poll slots every MS milliseconds, in case notifications are missed\n";
+    std::cerr << "  --index-timeout MS  wait up to MS milliseconds for the slot of a new virtual pad (default: 1000)\n";
+    std::cerr << "  --free-timeout MS   wait up to MS milliseconds for a removed virtual pad to free its slot (default: 1000)\n";
+    std::cerr << "  --add-timeout MS    wait up to MS milliseconds for virtual pads added at once to be registered (default: 5000)\n";
+    std::cerr << "  --priority          run slot handling at a raised priority (MMCSS)\n";
+    std::cerr << "  --affinity MASK     run slot handling on CPUs of the hexadecimal MASK\n";
+    std::cerr << "  --quiet             only log warnings and errors\n";
+    std::cerr << "  --log-file FILE     write logs to FILE instead of the console\n";
+    std::cerr << "  --trace             print a summary of phase durations at exit\n";
+    std::cerr << "  --trace-csv FILE    also write all trace records to FILE\n";
+    std::cerr << "  --record FILE       write slot events and timings to FILE, for replay by the benchmark\n";
+  }
+};
+
+/// System-wide lock held by the instance handling slots
+///
+/// Concurrent instances would count each other's virtual pads as plugged and fight over slots.
+/// Only the owner of the lock connects to the ViGEm bus, other instances forward their request to it.
+struct InstanceLock {
+  static constexpr wchar_t const* name = L"Local\\gamepad-slotter";
+
+  InstanceLock() {
+    m_mutex = CreateMutexW(nullptr, FALSE, name);
+    if (!m_mutex) {
+      throw std::runtime_error(std::format("CreateMutex() failed: {}", GetLastError()));
+    }
+  }
+
+  InstanceLock(InstanceLock const&) = delete;
+  InstanceLock& operator=(InstanceLock const&) = delete;
+
+  ~InstanceLock() {
+    if (m_owned) {
+      ReleaseMutex(m_mutex);
+    }
+    CloseHandle(m_mutex);
+  }
+
+  /// Try to acquire the lock, without waiting
+  bool tryLock() {
+    if (!m_owned) {
+      // An abandoned mutex means the previous owner crashed; its virtual pads are gone with it
+      auto const ret = WaitForSingleObject(m_mutex, 0);
+      m_owned = ret == WAIT_OBJECT_0 || ret == WAIT_ABANDONED;
+    }
+    return m_owned;
+  }
+
+  HANDLE m_mutex;
+  bool m_owned = false;
+};
+
+/// Named pipe receiving daemon commands
+///
+/// Each client sends a single-line command and receives a single-line reply.
+/// Only one client is served at a time.
+struct CommandPipe {
+  static constexpr wchar_t const* name = L"\\\\.\\pipe\\gamepad-slotter";
+  static constexpr DWORD buffer_size = 4096;  // fits the `metrics` reply
+
+  CommandPipe() {
+    m_pipe = CreateNamedPipeW(
+        name, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1, buffer_size, buffer_size, 0, nullptr);
+    if (m_pipe == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error(std::format("CreateNamedPipe() failed: {} (daemon already running?)", GetLastError()));
+    }
+    m_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!m_event) {
+      CloseHandle(m_pipe);
+      throw std::runtime_error("CreateEvent() failed");
+    }
+    listen();
+  }
+
+  CommandPipe(CommandPipe const&) = delete;
+  CommandPipe& operator=(CommandPipe const&) = delete;
+
+  ~CommandPipe() {
+    CancelIo(m_pipe);
+    CloseHandle(m_pipe);
+    CloseHandle(m_event);
+  }
+
+  /// Event signaled when a client is connected
+  HANDLE event() const { return m_event; }
+
+  /// Read the command of the connected client
+  ///
+  /// Return `std::nullopt` if no command could be read, the pipe is then ready for the next client.
+  std::optional<std::string> receive() {
+    DWORD size;
+    if (!GetOverlappedResult(m_pipe, &m_overlapped, &size, FALSE) && GetLastError() != ERROR_PIPE_CONNECTED) {
+      g_logger.warning("failed to connect pipe client: {}", GetLastError());
+      reset();
+      return std::nullopt;
+    }
+
+    // Clients send their command right after connecting, don't wait for long
+    auto constexpr read_timeout = 1000ms;
+    char buffer[buffer_size];
+    if (!ReadFile(m_pipe, buffer, sizeof(buffer), nullptr, &m_overlapped) && GetLastError() != ERROR_IO_PENDING) {
+      reset();
+      return std::nullopt;
+    }
+    if (WaitForSingleObject(m_event, static_cast<DWORD>(read_timeout.count())) != WAIT_OBJECT_0) {
+      CancelIo(m_pipe);
+    }
+    if (!GetOverlappedResult(m_pipe, &m_overlapped, &size, TRUE)) {
+      g_logger.warning("failed to read pipe command: {}", GetLastError());
+      reset();
+      return std::nullopt;
+    }
+
+    std::string command(buffer, size);
+    while (!command.empty() && std::isspace(static_cast<unsigned char>(command.back()))) {
+      command.pop_back();
+    }
+    return command;
+  }
+
+  /// Reply to the connected client, then wait for the next one
+  void reply(std::string_view message) {
+    DWORD size;
+    if (!WriteFile(m_pipe, message.data(), static_cast<DWORD>(message.size()), nullptr, &m_overlapped) && GetLastError() != ERROR_IO_PENDING) {
+      g_logger.warning("failed to write pipe reply: {}", GetLastError());
+    } else if (GetOverlappedResult(m_pipe, &m_overlapped, &size, TRUE)) {
+      FlushFileBuffers(m_pipe);  // wait for the client to read the reply
+    }
+    reset();
+  }
+
+  /// Send a command to the daemon, return its reply
+  static std::string send(std::string_view command) {
+    auto reply = trySend(command);
+    if (!reply) {
+      throw std::runtime_error("failed to send command to daemon: daemon not running or not responding");
+    }
+    return std::move(*reply);
+  }
+
+  /// Send a command to the daemon
+  ///
+  /// Return `std::nullopt` on transient errors: the pipe does not exist, or the server is busy or stopping.
+  static std::optional<std::string> trySend(std::string_view command) {
+    auto constexpr timeout = 5000ms;
+    char buffer[buffer_size];
+    DWORD size;
+    if (!CallNamedPipeW(name, const_cast<char*>(command.data()), static_cast<DWORD>(command.size()),
+                        buffer, sizeof(buffer), &size, static_cast<DWORD>(timeout.count()))) {
+      auto const error = GetLastError();
+      if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PIPE_BUSY || error == ERROR_BROKEN_PIPE || error == ERROR_SEM_TIMEOUT) {
+        return std::nullopt;
+      }
+      throw std::runtime_error(std::format("failed to send command to daemon: {}", error));
+    }
+    return std::string(buffer, size);
+  }
+
+ private:
+  /// Disconnect the current client and wait for a new one
+  void reset() {
+    DisconnectNamedPipe(m_pipe);
+    listen();
+  }
+
+  void listen() {
+    ResetEvent(m_event);
+    ZeroMemory(&m_overlapped, sizeof(m_overlapped));
+    m_overlapped.hEvent = m_event;
+    if (!ConnectNamedPipe(m_pipe, &m_overlapped)) {
+      auto const error = GetLastError();
+      if (error == ERROR_PIPE_CONNECTED) {
+        SetEvent(m_event);  // client connected in-between
+      } else if (error != ERROR_IO_PENDING) {
+        throw std::runtime_error(std::format("ConnectNamedPipe() failed: {}", error));
+      }
+    }
+  }
+
+  HANDLE m_pipe;
+  HANDLE m_event;
+  OVERLAPPED m_overlapped;
+};
+
+/// Event signaled on Ctrl+C, or when the console is closed
+///
+/// Main loops stop on it, so that virtual pads are properly removed.
+/// When the console is closed, or on logoff or shutdown, the process is terminated as soon as the handler returns:
+/// the handler waits for `done()` to be called first.
+struct ShutdownSignal {
+  ShutdownSignal() {
+    s_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!s_event) {
+      throw std::runtime_error("CreateEvent() failed");
+    }
+    if (!s_done && !(s_done = CreateEventW(nullptr, TRUE, FALSE, nullptr))) {
+      CloseHandle(s_event);
+      throw std::runtime_error("CreateEvent() failed");
+    }
+    if (!SetConsoleCtrlHandler(&onConsoleCtrl, TRUE)) {
+      g_logger.warning("SetConsoleCtrlHandler() failed: {}", GetLastError());
+    }
+  }
+
+  ShutdownSignal(ShutdownSignal const&) = delete;
+  ShutdownSignal& operator=(ShutdownSignal const&) = delete;
+
+  ~ShutdownSignal() {
+    SetConsoleCtrlHandler(&onConsoleCtrl, FALSE);
+    CloseHandle(s_event);
+  }
+
+  HANDLE event() const { return s_event; }
+
+  /// Notify the handler that cleanup is done, the process can be terminated
+  static void done() {
+    if (s_done) {
+      SetEvent(s_done);
+    }
+  }
+
+  static BOOL WINAPI onConsoleCtrl(DWORD type) {
+    SetEvent(s_event);
+    if (type == CTRL_CLOSE_EVENT || type == CTRL_LOGOFF_EVENT || type == CTRL_SHUTDOWN_EVENT) {
+      // Windows still terminates the process after a few seconds
+      WaitForSingleObject(s_done, INFINITE);
+    }
+    return TRUE;
+  }
+
+  // The handler has no user data
+  static inline HANDLE s_event = nullptr;
+  static inline HANDLE s_done = nullptr;  // never closed: the handler may still wait on it after destruction
+};
+
+/// Measure the time needed to get a pad plugged in each target, for metrics
+struct TargetWait {
+  /// Set the current target, record the wait if the previous one has been reached
+  void update(Pads const& pads, std::optional<size_t> target) {
+    auto const now = SystemBackend::now();
+    if (m_target && pads.hasRealPad(*m_target)) {
+      g_metrics.m_time_to_target.add(now - m_start);
+      g_recorder.record(RecordKind::Reached, now.time_since_epoch(), now - m_start, *m_target);
+    }
+    if (target != m_target) {
+      m_target = target;
+      m_start = now;
+      g_recorder.record(RecordKind::Target, now.time_since_epoch(), {}, target);
+    }
+  }
+
+  std::optional<size_t> m_target;
+  SystemBackend::Clock::time_point m_start;
+};
+
+/// Run as a daemon, keeping the ViGEm connection alive
+///
+/// Commands:
+/// - `reserve N...`: reserve slots N, in order, until a pad is plugged in each of them
+/// - `release`: release all reserved slots
+/// - `state`: return the current state
+/// - `metrics`: return counters and distributions, as `key=value` pairs
+/// - `profile NAME`: switch to a profile, only pads which differ are added or removed
+/// - `quit`: stop the daemon
+int runDaemon(Options const& options) {
+  auto const profiles = options.m_profiles.empty() ? std::vector<Profile>{} : Profile::load(options.m_profiles);
+  ShutdownSignal shutdown;
+  ScopedScheduling const scheduling(options.m_scheduling);
+  CommandPipe pipe;
+  SlotJournal journal;
+  Pads pads;
+  pads.m_timeouts = options.m_timeouts;
+  pads.m_backend.m_journal = &journal;
+  pads.waitOrphansUnplugged(journal.orphans());
+  if (options.m_warm_up) {
+    pads.m_backend.warmUp(XUSER_MAX_COUNT - 1);
+  }
+  SlotWatcher watcher(options.m_poll_interval, options.m_scheduling);
+  pads.m_backend.m_wake_event = watcher.wakeEvent();
+  if (!watcher.active()) {
+    g_logger.warning("device notifications unavailable, fallback to polling");
+  }
+
+  DeviceRouter router(options.m_rules, options.m_jit);
+
+  g_logger.info("Daemon started");
+  pads.printState();
+
+  std::vector<size_t> targets;
+  TargetWait wait;
+
+  // Reconcile the reservation with the current state
+  auto const reconcile = [&]() {
+    if (targets.empty()) {
+      return;
+    }
+    auto const target = pads.nextTarget(targets);
+    wait.update(pads, target);
+    if (target) {
+      router.fillSlots(pads, *target);
+    } else {
+      g_logger.info("All pads plugged, releasing slots");
+      targets.clear();
+      pads.freeAll();
+    }
+    pads.printState();
+  };
+
+  // Handle a command, return the reply
+  bool stop = false;
+  auto const handleCommand = [&](std::string_view command) -> std::string {
+    if (command.starts_with("reserve ")) {
+      auto const slots = parseSlots(command.substr(8));
+      if (!slots) {
+        return "ERROR: invalid slots";
+      }
+      if (!pads.nextTarget(*slots)) {
+        return "OK: pads already plugged";
+      }
+      targets = *slots;
+      pads.m_timeouts = options.m_timeouts;  // reset timeouts of the previous profile
+      reconcile();
+      return std::format("OK: waiting pads on slots{}", formatSlots(targets));
+    } else if (command.starts_with("profile ")) {
+      auto const name = command.substr(8);
+      auto const profile = ranges::find(profiles, name, &Profile::m_name);
+      if (profile == profiles.end()) {
+        return "ERROR: unknown profile";
+      }
+      // Managed pads are kept: reconciliation only adds or removes the ones that differ
+      auto const trace = g_tracer.scope("profile-switch");
+      g_logger.info("Switching to profile {}", profile->m_name);
+      pads.m_timeouts = profile->timeouts(options.m_timeouts);
+      targets = profile->m_targets;
+      reconcile();
+      if (targets.empty()) {
+        return std::format("OK: profile {}, pads already plugged", profile->m_name);
+      }
+      return std::format("OK: profile {}, waiting pads on slots{}", profile->m_name, formatSlots(targets));
+    } else if (command == "release") {
+      targets.clear();
+      wait.update(pads, std::nullopt);
+      pads.freeAll();
+      pads.printState();
+      return "OK";
+    } else if (command == "state") {
+      return pads.formatState();
+    } else if (command == "metrics") {
+      return g_metrics.format();
+    } else if (command == "quit") {
+      stop = true;
+      return "OK";
+    } else {
+      return "ERROR: unknown command";
+    }
+  };
+
+  // Don't wake up until something happens
+  auto& timer = pads.m_backend.m_timer;
+  while (!stop) {
+    auto const signaled = timer.waitAny({shutdown.event(), watcher.event(), pipe.event()}, router.deadline());
+    if (signaled == 0) {
+      g_logger.info("Interrupted");
+      break;
+    } else if (signaled == 1) {
+      auto const target = targets.empty() ? std::nullopt : pads.nextTarget(targets);
+      bool const opened = router.handleEvents(pads, target, watcher.takeDeviceEvents());
+      bool const changed = watcher.apply(pads);
+      router.traceLanding(pads);
+      if (changed || opened) {
+        reconcile();
+      }
+    } else if (signaled == 2) {
+      if (auto const command = pipe.receive()) {
+        g_logger.info("Command: {}", *command);
+        pipe.reply(handleCommand(*command));
+      }
+    } else if (router.checkExpired(pads)) {
+      reconcile();
+    }
+  }
+
+  g_logger.info("Daemon stopped");
+  return EXIT_SUCCESS;
+}
+
+
+/// Return a handle on a running process with given executable name, or `nullptr`
+HANDLE openProcessByName(std::wstring const& name) {
+  auto const snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    g_logger.warning("CreateToolhelp32Snapshot() failed: {}", GetLastError());
+    return nullptr;
+  }
+  HANDLE process = nullptr;
+  PROCESSENTRY32W entry;
+  entry.dwSize = sizeof(entry);
+  for (bool found = Process32FirstW(snapshot, &entry); found && !process; found = Process32NextW(snapshot, &entry)) {
+    std::wstring exe = entry.szExeFile;
+    ranges::transform(exe, exe.begin(), [](wchar_t c) { return std::towlower(c); });
+    if (exe == name) {
+      process = OpenProcess(SYNCHRONIZE, FALSE, entry.th32ProcessID);
+    }
+  }
+  CloseHandle(snapshot);
+  return process;
+}
+
+/// Remove virtual pads according to the release policy
+///
+/// Pads which are not removed here are removed all at once on exit.
+/// Commands received meanwhile are replied using `handle`, other instances must not be left hanging.
+/// Return `false` if interrupted.
+template <class F>
+bool releasePads(Pads& pads, ReleasePolicy const& policy, ShutdownSignal const& shutdown, CommandPipe& pipe, F const& handle) {
+  using Mode = ReleasePolicy::Mode;
+  auto& timer = pads.m_backend.m_timer;
+
+  // Wait for shutdown (0) or `event` (2), if any, serving the pipe meanwhile; return `std::nullopt` on timeout
+  auto const wait = [&](HANDLE event, SystemBackend::Clock::time_point deadline) -> std::optional<size_t> {
+    for (;;) {
+      auto const signaled = event
+          ? timer.waitAny({shutdown.event(), pipe.event(), event}, deadline)
+          : timer.waitAny({shutdown.event(), pipe.event()}, deadline);
+      if (signaled != 1) {
+        return signaled;
+      }
+      if (auto const command = pipe.receive()) {
+        g_logger.info("Command: {}", *command);
+        pipe.reply(handle(*command));
+      }
+    }
+  };
+
+  switch (policy.m_mode) {
+    case Mode::All:
+      return true;
+
+    case Mode::Keep: {
+      g_logger.info("Keeping virtual pads until interrupted");
+      auto const trace = g_tracer.scope("release-keep");
+      wait(nullptr, SystemBackend::Clock::time_point::max());
+      return false;
+    }
+
+    case Mode::Paced: {
+      auto const trace = g_tracer.scope("release-paced");
+      bool first = true;
+      for (size_t i = 0; i < pads.m_slots.size(); ++i) {
+        if (!pads.m_slots[i].m_managed) {
+          continue;
+        }
+        if (!first && wait(nullptr, SystemBackend::now() + policy.m_pace)) {
+          return false;
+        }
+        first = false;
+        pads.freeSlot(i);
+      }
+      return true;
+    }
+
+    case Mode::OnExit: {
+      // The process may not be started yet
+      auto constexpr lookup_interval = 500ms;
+      auto const trace = g_tracer.scope("release-on-exit");
+      HANDLE process;
+      bool waiting = false;
+      while (!(process = openProcessByName(policy.m_process))) {
+        if (!waiting) {
+          g_logger.info("Waiting for process to start...");
+          waiting = true;
+        }
+        if (wait(nullptr, SystemBackend::now() + lookup_interval)) {
+          return false;
+        }
+      }
+      g_logger.info("Waiting for process to exit...");
+      auto const signaled = wait(process, SystemBackend::Clock::time_point::max());
+      CloseHandle(process);
+      return signaled == 2;
+    }
+  }
+  return true;
+}
+
+/// Wait for a pad to be plugged in the target slot
+///
+/// In guard mode, keep the virtual pads afterwards: if a target pad is unplugged, its slot is the only free one.
+int runOnce(Options const& options) {
+  auto targets = options.m_targets;
+
+  ShutdownSignal shutdown;
+  ScopedScheduling const scheduling(options.m_scheduling);
+  CommandPipe pipe;  // receive requests forwarded by other instances
+  SlotJournal journal;
+  Pads pads;
+  pads.m_timeouts = options.m_timeouts;
+  pads.m_backend.m_journal = &journal;
+  pads.waitOrphansUnplugged(journal.orphans());
+  pads.printState();
+
+  auto target = pads.nextTarget(targets);
+  if (!target) {
+    g_logger.info("Pads already plugged on slots{}", formatSlots(targets));
+    return EXIT_SUCCESS;
+  }
+  if (options.m_warm_up) {
+    pads.m_backend.warmUp(XUSER_MAX_COUNT - 1);
+  }
+
+  // Slots are watched from another thread, the main one reacts to changes
+  SlotWatcher watcher(options.m_poll_interval, options.m_scheduling);
+  pads.m_backend.m_wake_event = watcher.wakeEvent();
+  if (!watcher.active()) {
+    g_logger.warning("device notifications unavailable, fallback to polling");
+  }
+
+  DeviceRouter router(options.m_rules, options.m_jit);
+  TargetWait wait;
+  wait.update(pads, target);
+  router.fillSlots(pads, *target);
+  g_logger.info("Waiting pad on slot {}...", *target + 1);
+  pads.printState();
+
+  // Handle a request forwarded by another instance, return the reply
+  auto const handleCommand = [&](std::string_view command, bool& changed) -> std::string {
+    if (command.starts_with("reserve ")) {
+      auto const slots = parseSlots(command.substr(8));
+      if (!slots) {
+        return "ERROR: invalid slots";
+      }
+      // Unlike the daemon, keep the current targets: they are still awaited by this instance
+      for (auto const slot : *slots) {
+        if (ranges::find(targets, slot) == targets.end()) {
+          targets.push_back(slot);
+        }
+      }
+      changed = true;
+      return std::format("OK: waiting pads on slots{}", formatSlots(targets));
+    } else if (command == "state") {
+      return pads.formatState();
+    } else if (command == "metrics") {
+      return g_metrics.format();
+    } else {
+      return "ERROR: unknown command";
+    }
+  };
+
+  auto& timer = pads.m_backend.m_timer;
+  auto guard_until = SystemBackend::Clock::time_point::max();  // end of the quiet period, when guarding
+  for (;;) {
+    bool changed = false;
+    auto const signaled = timer.waitAny({shutdown.event(), watcher.event(), pipe.event()}, std::min(router.deadline(), guard_until));
+    if (signaled == 0) {
+      g_logger.info("Interrupted");
+      return target ? EXIT_FAILURE : EXIT_SUCCESS;
+    } else if (signaled == 1) {
+      changed = router.handleEvents(pads, target, watcher.takeDeviceEvents());
+      changed |= watcher.apply(pads);
+      router.traceLanding(pads);
+    } else if (signaled == 2) {
+      if (auto const command = pipe.receive()) {
+        g_logger.info("Command: {}", *command);
+        pipe.reply(handleCommand(*command, changed));
+      }
+    } else if (SystemBackend::now() >= guard_until) {
+      g_logger.info("No change for {}s, releasing slots", options.m_release_after->count());
+      break;
+    }
+    changed |= router.checkExpired(pads);
+    if (!changed) {
+      continue;
+    }
+
+    // Move to the next target once a pad is plugged; fill again, in case an unmanaged gamepad has been unplugged
+    auto const next = pads.nextTarget(targets);
+    wait.update(pads, next);
+    if (!next) {
+      if (!options.m_guard) {
+        break;
+      }
+      if (target) {
+        g_logger.info("All pads plugged, guarding slots");
+        target.reset();
+      }
+      // Each change restarts the quiet period
+      if (options.m_release_after) {
+        guard_until = SystemBackend::now() + *options.m_release_after;
+      }
+    } else {
+      router.fillSlots(pads, *next);
+      if (next != target) {
+        target = next;
+        g_logger.info("Waiting pad on slot {}...", *target + 1);
+      }
+      guard_until = SystemBackend::Clock::time_point::max();
+    }
+    pads.printState();
+  }
+
+  // Slots are not awaited anymore, new requests would never be served
+  auto const handleReleaseCommand = [&](std::string_view command) -> std::string {
+    if (command.starts_with("reserve ")) {
+      return "ERROR: releasing virtual pads";
+    }
+    bool changed = false;
+    return handleCommand(command, changed);
+  };
+  if (!releasePads(pads, options.m_release, shutdown, pipe, handleReleaseCommand)) {
+    g_logger.info("Interrupted");
+  }
+  return EXIT_SUCCESS;
+}
+
+/// Forward a request to the running instance, if any
+///
+/// Return the reply, or `std::nullopt` if `instance` has been locked: the request must be handled locally.
+std::optional<std::string> forwardRequest(InstanceLock& instance, std::vector<size_t> const& targets) {
+  // The running instance may not serve its pipe yet, or be stopping
+  auto constexpr retry_delay = 50ms;
+  auto constexpr timeout = 5000ms;
+  auto const deadline = SystemBackend::now() + timeout;
+  while (!instance.tryLock()) {
+    if (auto reply = CommandPipe::trySend(std::format("reserve{}", formatSlots(targets)))) {
+      g_logger.info("Request forwarded to the running instance");
+      return reply;
+    }
+    if (SystemBackend::now() >= deadline) {
+      throw std::runtime_error("running instance does not accept requests");
+    }
+    std::this_thread::sleep_for(retry_delay);
+  }
+  return std::nullopt;
+}
+
+int main(int argc, char* argv[]) {
+  auto const options = Options::parse(argc, argv);
+  if (!options) {
+    Options::printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  g_tracer.m_enabled = options->m_trace;
+
+  std::ofstream log_file;
+  if (!options->m_log_file.empty()) {
+    log_file.open(options->m_log_file, std::ios::app);
+    if (!log_file) {
+      std::cerr << std::format("FATAL: cannot open log file: {}\n", options->m_log_file);
+      return EXIT_FAILURE;
+    }
+  }
+  if (!options->m_record.empty()) {
+    try {
+      g_recorder.open(options->m_record);
+    } catch (std::exception const& e) {
+      std::cerr << "FATAL: " << e.what() << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  auto const min_severity = options->m_quiet ? Severity::Warning : Severity::Info;
+  if (log_file.is_open()) {
+    g_logger.start(log_file, log_file, min_severity);
+  } else {
+    g_logger.start(std::cout, std::cerr, min_severity);
+  }
+
+  int ret;
+  try {
+    InstanceLock instance;
+    if (!options->m_command.empty()) {
+      auto const reply = CommandPipe::send(options->m_command);
+      std::cout << reply << "\n";
+      return reply.starts_with("ERROR") ? EXIT_FAILURE : EXIT_SUCCESS;
+    } else if (options->m_daemon) {
+      if (!instance.tryLock()) {
+        throw std::runtime_error("another instance is running");
+      }
+      ret = runDaemon(*options);
+    } else if (auto const reply = forwardRequest(instance, options->m_targets)) {
+      std::cout << *reply << "\n";
+      ret = reply->starts_with("ERROR") ? EXIT_FAILURE : EXIT_SUCCESS;
+    } else {
+      ret = runOnce(*options);
+    }
+  } catch (std::exception const& e) {
+    g_logger.stop();  // write pending messages first
+    std::cerr << "FATAL: " << e.what() << "\n";
+    ret = EXIT_FAILURE;
+  }
+  g_logger.stop();
+
+  if (options->m_trace) {
+    std::cout << "Trace summary:\n";
+    g_tracer.printSummary(std::cout);
+    if (!options->m_trace_csv.empty()) {
+      try {
+        g_tracer.writeCsv(options->m_trace_csv);
+      } catch (std::exception const& e) {
+        std::cerr << "ERROR: " << e.what() << "\n";
+      }
+    }
+  }
+  try {
+    g_recorder.close();
+  } catch (std::exception const& e) {
+    std::cerr << "ERROR: " << e.what() << "\n";
+  }
+  ShutdownSignal::done();
+  return ret;
+}
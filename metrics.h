@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <format>
+#include <string>
+#include <string_view>
+
+/// Distribution of durations, with fixed buckets
+struct Histogram {
+  using Duration = std::chrono::nanoseconds;
+
+  /// Upper bounds of buckets, in milliseconds; last bucket has no bound
+  static constexpr std::array<int, 12> bounds_ms = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+
+  void add(Duration duration) {
+    size_t i = 0;
+    while (i < bounds_ms.size() && duration > std::chrono::milliseconds(bounds_ms[i])) {
+      ++i;
+    }
+    ++m_buckets[i];
+    ++m_count;
+    m_sum += duration;
+  }
+
+  /// Format as `key=value` pairs, buckets are cumulative
+  std::string format(std::string_view name) const {
+    auto const sum_ms = std::chrono::duration<double, std::milli>(m_sum).count();
+    std::string out = std::format("{}_count={} {}_sum_ms={:.3f}", name, m_count, name, sum_ms);
+    size_t cumulated = 0;
+    for (size_t i = 0; i < bounds_ms.size(); ++i) {
+      cumulated += m_buckets[i];
+      out += std::format(" {}_le_{}ms={}", name, bounds_ms[i], cumulated);
+    }
+    return out;
+  }
+
+  std::array<size_t, bounds_ms.size() + 1> m_buckets{};
+  size_t m_count = 0;
+  Duration m_sum{};
+};
+
+/// Counters and distributions, for monitoring
+///
+/// Unlike trace records, they are always collected and have a fixed size.
+struct Metrics {
+  /// Format as a single line of `key=value` pairs
+  std::string format() const {
+    std::string out = std::format("fills={} frees={} still_unplugged={} virtual_unplugged={} index_timeouts={}",
+                                  m_fills, m_frees, m_still_unplugged, m_virtual_unplugged, m_index_timeouts);
+    out += " " + m_index_poll.format("index_poll");
+    out += " " + m_time_to_target.format("time_to_target");
+    return out;
+  }
+
+  size_t m_fills = 0;  // calls to `fillSlots()`
+  size_t m_frees = 0;  // calls to `freeSlot()`
+  size_t m_still_unplugged = 0;  // reserved slots not plugged after `reconcile()`
+  size_t m_virtual_unplugged = 0;  // managed slots found unplugged
+  size_t m_index_timeouts = 0;  // index of a new virtual pad not found
+  Histogram m_index_poll;  // waits for a new virtual pad, when its index is not notified
+  Histogram m_time_to_target;  // from start of the wait to a pad plugged in the target slot
+};
+
+inline Metrics g_metrics;
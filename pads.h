@@ -0,0 +1,679 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "log.h"
+#include "metrics.h"
+#include "record.h"
+#include "trace.h"
+
+using namespace std::chrono_literals;
+
+
+/// Schedule probes of slots
+///
+/// Plugged and just changed slots are probed every time.
+/// Probes of slots which stay empty are delayed exponentially, since they are the slow ones.
+template <class Clock, size_t N>
+struct ProbeScheduler {
+  using Time = typename Clock::time_point;
+  using Duration = typename Clock::duration;
+
+  static constexpr Duration min_backoff = std::chrono::milliseconds(10);
+  static constexpr Duration max_backoff = std::chrono::milliseconds(800);
+
+  struct Slot {
+    Time m_next = Time::min();
+    Duration m_interval = Duration::zero();
+  };
+
+  /// Return `true` if given slot should be probed
+  bool isDue(size_t index, Time now) const { return now >= m_slots.at(index).m_next; }
+
+  /// Schedule the next probe of a slot
+  void probed(size_t index, Time now, bool plugged, bool changed) {
+    auto& slot = m_slots.at(index);
+    if (plugged || changed) {
+      slot.m_interval = Duration::zero();
+    } else {
+      slot.m_interval = std::clamp(slot.m_interval * 2, min_backoff, max_backoff);
+    }
+    slot.m_next = now + slot.m_interval;
+  }
+
+  /// Probe a slot on next update, e.g. after it changed
+  void changed(size_t index) { m_slots.at(index) = {}; }
+
+  /// Probe all slots on next update, e.g. after a device change
+  void reset() { m_slots.fill({}); }
+
+  std::array<Slot, N> m_slots;
+};
+
+/// State of a single slot, packed as `plugged | managed << 1`
+enum class SlotState: uint8_t {
+  Empty = 0b00,
+  Real = 0b01,  // plugged with a real pad
+  Missing = 0b10,  // managed pad not plugged; erroneous
+  Virtual = 0b11,  // plugged with a managed pad
+};
+
+/// Change reported when a probe updates the state of a slot
+enum class SlotChange: uint8_t { None, Plugged, Unplugged, VirtualUnplugged };
+
+/// Change of each probe transition, indexed by old and new states
+///
+/// Probes only change the plugged bit: other transitions report nothing.
+inline constexpr auto slot_transitions = [] {
+  std::array<std::array<SlotChange, 4>, 4> table{};
+  auto const set = [&](SlotState from, SlotState to, SlotChange change) {
+    table[static_cast<size_t>(from)][static_cast<size_t>(to)] = change;
+  };
+  set(SlotState::Empty, SlotState::Real, SlotChange::Plugged);
+  set(SlotState::Real, SlotState::Empty, SlotChange::Unplugged);
+  set(SlotState::Virtual, SlotState::Missing, SlotChange::VirtualUnplugged);
+  set(SlotState::Missing, SlotState::Missing, SlotChange::VirtualUnplugged);  // still erroneous
+  return table;
+}();
+
+/// Packed state of all slots, in a single word
+///
+/// Plugged, managed and target slots are stored as masks, with one bit per slot.
+/// Changes between two snapshots are given by a single XOR.
+struct SlotSnapshot {
+  static constexpr size_t max_slots = 8;
+  static constexpr unsigned plugged_shift = 0;
+  static constexpr unsigned managed_shift = 8;
+  static constexpr unsigned target_shift = 16;
+
+  static constexpr uint32_t bit(size_t index) { return uint32_t(1) << index; }
+
+  constexpr uint32_t plugged() const { return (m_bits >> plugged_shift) & 0xff; }
+  constexpr uint32_t managed() const { return (m_bits >> managed_shift) & 0xff; }
+  constexpr uint32_t targets() const { return (m_bits >> target_shift) & 0xff; }
+
+  constexpr SlotState state(size_t index) const {
+    return static_cast<SlotState>(((plugged() >> index) & 1) | ((managed() >> index) & 1) << 1);
+  }
+
+  constexpr void set(size_t index, SlotState state) {
+    auto const value = static_cast<uint32_t>(state);
+    m_bits &= ~((bit(index) << plugged_shift) | (bit(index) << managed_shift));
+    m_bits |= ((value & 1) << index) << plugged_shift | ((value >> 1) << index) << managed_shift;
+  }
+
+  constexpr void setTarget(size_t index) { m_bits |= bit(index) << target_shift; }
+
+  /// Return bits which differ between two snapshots
+  constexpr SlotSnapshot operator^(SlotSnapshot other) const { return {m_bits ^ other.m_bits}; }
+
+  uint32_t m_bits = 0;
+};
+
+/// Manage state of connected pads
+///
+/// Gamepads are probed and created through a backend which provides:
+/// - `Pad`, a handle on a virtual gamepad
+/// - `Clock`, used for timeouts, `now()` and `sleepUntil()`
+/// - `slot_count`, the number of slots
+/// - `m_backend.isPadPlugged()`, to probe a single slot
+/// - `addPad()`, `addPads()` and `removePad()` to manage virtual gamepads; `addPads()` may return fewer pads than requested
+/// - `waitPadIndex()` and `queryPadIndex()` to retrieve the slot of a virtual gamepad
+/// - optionally, `probeAll()` to probe all slots at once
+/// - optionally, `saveManaged()` to persist which slots are managed, on each change
+template <class Backend>
+struct ConnectedPads {
+  using Pad = typename Backend::Pad;
+  using Time = typename Backend::Clock::time_point;
+  using Duration = typename Backend::Clock::duration;
+
+  static_assert(Backend::slot_count <= SlotSnapshot::max_slots);
+
+  /// State of a gamepad slot
+  ///
+  /// Some states are invalid/erroneous
+  struct Slot {
+    bool m_plugged = false;
+    Pad m_managed = nullptr;
+    Time m_updated{};  // time of the last probe or change
+  };
+
+  /// Create pads, arguments are forwarded to the backend
+  template <class... Args>
+  explicit ConnectedPads(Args&&... args): m_backend(std::forward<Args>(args)...) {
+    // Initiliaze the state, don't log alreay connected pads
+    // Empty slots are slow to probe, probe them concurrently if possible.
+    std::array<bool, Backend::slot_count> plugged;
+    auto const start = m_backend.now();
+    if constexpr (requires(Backend& backend) { backend.probeAll(); }) {
+      plugged = m_backend.probeAll();
+    } else {
+      for (size_t i = 0; i < m_slots.size(); ++i) {
+        plugged[i] = m_backend.isPadPlugged(i);
+      }
+    }
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      m_slots[i].m_updated = m_backend.now();
+      m_slots[i].m_plugged = plugged[i];
+      g_recorder.record(RecordKind::Initial, start.time_since_epoch(), m_backend.now() - start, i, plugged[i]);
+    }
+  }
+
+  /// Return the state of a slot
+  SlotState state(size_t index) const {
+    auto const& slot = m_slots.at(index);
+    return static_cast<SlotState>(static_cast<uint8_t>(slot.m_plugged) | static_cast<uint8_t>(slot.m_managed != nullptr) << 1);
+  }
+
+  /// Return a packed state of all slots, with given target slots
+  SlotSnapshot snapshot(std::vector<size_t> const& targets = {}) const {
+    SlotSnapshot snapshot;
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      snapshot.set(i, state(i));
+    }
+    for (auto const target : targets) {
+      snapshot.setTarget(target);
+    }
+    return snapshot;
+  }
+
+  /// Return true if given slot is plugged with a real pad
+  bool hasRealPad(size_t index) const { return state(index) == SlotState::Real; }
+
+  /// Return the first of given slots without a real pad
+  std::optional<size_t> nextTarget(std::vector<size_t> const& targets) const {
+    auto const current = snapshot(targets);
+    auto const missing = current.targets() & ~(current.plugged() & ~current.managed());
+    for (auto const target : targets) {
+      if (missing & SlotSnapshot::bit(target)) {
+        return target;
+      }
+    }
+    return std::nullopt;
+  }
+
+  /// Format the current state
+  std::string formatState() const {
+    // Real pads are shown by their slot number
+    static constexpr std::array<char, 4> state_chars = {'-', '?', 'X', 'x'};
+    std::string out = "State:";
+    auto const current = snapshot();
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      auto const state = current.state(i);
+      auto const c = state == SlotState::Real ? static_cast<char>('1' + i) : state_chars[static_cast<size_t>(state)];
+      out += std::format("  {}", c);
+    }
+    return out;
+  }
+
+  /// Log the current state
+  void printState() const {
+    g_logger.info("{}", formatState());
+  }
+
+  /// Update a slot from a probe made at given time, possibly by another thread
+  ///
+  /// Probes older than the last update of the slot are outdated, they are ignored.
+  /// Return `true` if state changed.
+  bool applyPlugged(size_t index, bool plugged, Time time) {
+    auto& slot = m_slots.at(index);
+    if (time < slot.m_updated) {
+      return false;
+    }
+    slot.m_updated = time;
+
+    // Log state changes and invalid states
+    auto const before = state(index);
+    slot.m_plugged = plugged;
+    auto const after = state(index);
+    switch (slot_transitions[static_cast<size_t>(before)][static_cast<size_t>(after)]) {
+      case SlotChange::None:
+        break;
+      case SlotChange::Plugged:
+      case SlotChange::Unplugged:
+        g_logger.info("Pad {} {}", index + 1, plugged ? "plugged" : "unplugged");
+        g_recorder.record(RecordKind::Physical, time.time_since_epoch(), {}, index, plugged);
+        break;
+      case SlotChange::VirtualUnplugged:
+        ++g_metrics.m_virtual_unplugged;
+        g_logger.warning("virtual pad unplugged on slot {}", index + 1);
+        break;
+    }
+    return before != after;
+  }
+
+  /// Update plugged pads by probing slots
+  ///
+  /// Slots are probed according to `m_probes`: slots which stay empty are probed less often.
+  /// Return `true` if state changed.
+  bool updatePlugged() {
+    auto const start = Tracer::Clock::now();
+    auto const before = snapshot();
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      auto const now = m_backend.now();
+      if (!m_probes.isDue(i, now)) {
+        continue;
+      }
+      if (updateSlot(i)) {
+        g_tracer.record(m_slots[i].m_plugged ? "plugged" : "unplugged", start, i);
+      }
+    }
+    return (before ^ snapshot()).plugged() != 0;
+  }
+
+  /// Probe a single slot now, even if not due
+  ///
+  /// Return `true` if state changed.
+  bool updateSlot(size_t index) {
+    auto const now = m_backend.now();
+    bool const plugged = probe(index);
+    m_probes.probed(index, now, plugged, m_slots.at(index).m_plugged != plugged);
+    return applyPlugged(index, plugged, now);
+  }
+
+  /// Probe a slot until a real pad is plugged in it, or until the timeout
+  ///
+  /// Used when a real pad is about to take a freed slot: it usually takes it right away, the gap is not noticed otherwise.
+  /// Return `true` if a real pad is plugged before the timeout.
+  bool waitRealPad(size_t index, Duration timeout) {
+    return pollUntil(timeout, [&] {
+      updateSlot(index);
+      return hasRealPad(index);
+    });
+  }
+
+  /// Call `done()` until it returns `true`, or until the timeout
+  ///
+  /// Calls are tight at first, since waited changes are usually quick, then back off.
+  /// Wake-ups are scheduled on absolute times, so that slow calls don't make the timeout drift.
+  /// The backend may wake up early, e.g. on device notifications.
+  /// Return `true` if done before the timeout.
+  template <class F>
+  bool pollUntil(Duration timeout, F&& done) {
+    auto const start = m_backend.now();
+    auto const deadline = start + timeout;
+    Duration period = tight_poll_period;
+    for (auto next = start; ; ) {
+      if (done()) {
+        return true;
+      }
+      auto const now = m_backend.now();
+      if (now >= deadline) {
+        return false;
+      }
+      if (now - start >= tight_poll_duration) {
+        period = std::min(period * 2, max_poll_period);
+      }
+      next = std::max(next + period, now);  // don't catch up on missed periods
+      m_backend.sleepUntil(std::min(next, deadline));
+    }
+  }
+
+  /// Update plugged pads until the state changes
+  ///
+  /// Used when slot events have been lost: all slots are probed again, starting at a fast pace.
+  /// Return `true` if state changed before the timeout.
+  bool pollChange(std::chrono::milliseconds timeout) {
+    m_probes.reset();
+    return pollUntil(timeout, [&] { return updatePlugged(); });
+  }
+
+  /// Add managed pads, they fill the first unplugged slots
+  void fillSlots(size_t count) {
+    ++g_metrics.m_fills;
+
+    // `vigem_target_x360_get_user_index()` is unreliable; it sometimes fails.
+    // Fallback used when no X360 notification is received.
+    // Assume no new device is manually plugged in between and poll `XInputGetState()`
+    auto const pollNewIndex = [&]() -> std::optional<size_t> {
+      auto const trace = g_tracer.scope("index-poll");
+      auto const start = m_backend.now();
+      std::optional<size_t> index;
+      auto const found = pollUntil(m_timeouts.m_index, [&] {
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+          if (m_slots[i].m_plugged) {
+            continue;  // don't poll already plugged slots
+          }
+          if (probe(i)) {
+            index = i;
+            return true;
+          }
+        }
+        return false;
+      });
+      if (!found) {
+        ++g_metrics.m_index_timeouts;
+        return std::nullopt;
+      }
+      g_metrics.m_index_poll.add(m_backend.now() - start);
+      return index;
+    };
+
+    // The LED number is reported through X360 notifications once the pad is assigned a slot
+    auto constexpr notification_timeout = 250ms;
+    auto const waitNotifiedIndex = [&](Pad pad) -> std::optional<size_t> {
+      auto const start = Tracer::Clock::now();
+      auto const index = m_backend.waitPadIndex(pad, m_backend.now() + notification_timeout);
+      if (index) {
+        g_tracer.record("index-notification", start, *index);
+      }
+      return index;
+    };
+
+    // Assign a new pad to its slot, remove it if the slot is already managed
+    auto const placePad = [&](Pad pad, size_t index, bool notified) {
+      auto& slot = m_slots.at(index);
+      if (slot.m_managed) {
+        g_logger.warning("virtual pad created on an already managed slot: {}", index + 1);
+        m_backend.removePad(pad);
+      } else {
+        if (slot.m_plugged) {
+          // Polling only returns unplugged slots: the index has been reported by the driver.
+          // The slot is free, its pad has been unplugged in-between.
+          g_logger.info("Pad {} unplugged", index + 1);
+        }
+        slot.m_plugged = true;
+        slot.m_managed = pad;
+        slot.m_updated = m_backend.now();
+        m_probes.changed(index);
+        saveManaged();
+        g_recorder.record(RecordKind::Place, slot.m_updated.time_since_epoch(), {}, index, notified);
+      }
+    };
+
+    // Place a new pad if its slot has been found, remove it otherwise
+    // A later `reconcile()` attempt will retry.
+    bool dropped = false;
+    auto const placeFound = [&](Pad pad, std::optional<size_t> index, bool notified) {
+      if (index) {
+        placePad(pad, *index, notified);
+      } else {
+        g_logger.warning("failed to get index of new virtual pad (timeout), removing it");
+        m_backend.removePad(pad);
+        dropped = true;
+      }
+    };
+
+    // Create pads for the unplugged slots, all at once
+    // Pads are added concurrently, the slot of each pad has to be retrieved afterwards.
+    auto const add_start = m_backend.now();
+    auto const pads = m_backend.addPads(count, m_timeouts.m_add);
+    g_recorder.record(RecordKind::Add, add_start.time_since_epoch(), m_backend.now() - add_start, std::nullopt, static_cast<uint8_t>(count));
+    std::vector<Pad> unresolved;
+    auto const start = Tracer::Clock::now();
+    auto const deadline = m_backend.now() + notification_timeout;
+    for (auto const& pad : pads) {
+      auto index = m_backend.waitPadIndex(pad, deadline);
+      if (!index) {
+        index = m_backend.queryPadIndex(pad);
+      }
+      if (index) {
+        g_tracer.record("index-notification", start, *index);
+        placePad(pad, *index, true);
+      } else {
+        unresolved.push_back(pad);
+      }
+    }
+
+    if (unresolved.size() == 1) {
+      // Only one pad left, it's the next one to appear
+      placeFound(unresolved.front(), pollNewIndex(), false);
+    } else if (!unresolved.empty()) {
+      // Pads cannot be told apart: add them again, one by one
+      g_logger.warning("cannot get index of {} new virtual pads, adding them one by one", unresolved.size());
+      for (auto const& pad : unresolved) {
+        m_backend.removePad(pad);
+      }
+      waitUnmanagedUnplugged();
+      for (size_t i = 0; i < unresolved.size(); ++i) {
+        auto const retry_start = m_backend.now();
+        auto pad = m_backend.addPad();
+        g_recorder.record(RecordKind::Add, retry_start.time_since_epoch(), m_backend.now() - retry_start, std::nullopt, 1);
+        if (auto const index = waitNotifiedIndex(pad)) {
+          placeFound(pad, index, true);
+        } else {
+          placeFound(pad, pollNewIndex(), false);
+        }
+      }
+    }
+    if (dropped) {
+      waitUnmanagedUnplugged();  // removed pads may have been assigned a slot afterwards
+    }
+
+    // Check final state
+    updatePlugged();  // will log unplugged managed pads
+  }
+
+  /// Free the given slot, if it is managed
+  void freeSlot(size_t index) {
+    if (index >= m_slots.size()) {
+      g_logger.error("invalid slot: {}", index + 1);
+    }
+    auto& slot = m_slots.at(index);
+    if (!slot.m_managed) {
+      g_logger.error("cannot free unmanaged slot: {}", index + 1);
+      return;
+    }
+
+    ++g_metrics.m_frees;
+    {
+      auto const trace = g_tracer.scope("remove", index);
+      m_backend.removePad(slot.m_managed);
+      slot.m_managed = nullptr;
+    }
+    saveManaged();
+
+    // Wait for pad to be actually unplugged
+    auto const trace = g_tracer.scope("free-wait", index);
+    auto const start = m_backend.now();
+    g_recorder.record(RecordKind::Remove, start.time_since_epoch(), {}, index);
+    pollUntil(m_timeouts.m_free, [&] {
+      slot.m_plugged = probe(index);
+      return !slot.m_plugged;
+    });
+    slot.m_updated = m_backend.now();
+    g_recorder.record(RecordKind::Freed, slot.m_updated.time_since_epoch(), slot.m_updated - start, index, slot.m_plugged);
+    if (slot.m_plugged) {
+      g_logger.warning("managed slot {} has been freed but is still plugged", index + 1);
+    }
+    m_probes.changed(index);
+  }
+
+  /// Wait for slots not marked as plugged to be actually unplugged
+  ///
+  /// Used after removing pads not assigned to a slot.
+  void waitUnmanagedUnplugged() {
+    auto const unplugged = pollUntil(m_timeouts.m_free, [&] {
+      for (size_t i = 0; i < m_slots.size(); ++i) {
+        if (!m_slots[i].m_plugged && probe(i)) {
+          return false;
+        }
+      }
+      return true;
+    });
+    if (unplugged) {
+      return;
+    }
+    g_logger.warning("removed virtual pads are still plugged");
+    // Remaining pads may be real ones plugged in-between
+    updatePlugged();
+  }
+
+  /// Wait for virtual pads left by a previous run to be unplugged
+  ///
+  /// Their owner is gone, so the bus removes them; until then, they would be taken for real pads.
+  /// Pads still plugged after the timeout are assumed to be real ones, plugged in-between.
+  void waitOrphansUnplugged(std::array<bool, Backend::slot_count> const& orphans) {
+    auto const isOrphan = [&](size_t i) { return orphans[i] && m_slots[i].m_plugged; };
+    bool any = false;
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      any = any || isOrphan(i);
+    }
+    if (!any) {
+      return;
+    }
+    g_logger.info("Waiting for virtual pads of a previous run to be removed");
+    auto const trace = g_tracer.scope("orphan-wait");
+    pollUntil(m_timeouts.m_free, [&] {
+      bool done = true;
+      for (size_t i = 0; i < m_slots.size(); ++i) {
+        if (isOrphan(i)) {
+          m_slots[i].m_plugged = probe(i);
+          m_slots[i].m_updated = m_backend.now();
+          done = done && !m_slots[i].m_plugged;
+        }
+      }
+      return done;
+    });
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      if (orphans[i]) {
+        if (m_slots[i].m_plugged) {
+          g_logger.warning("virtual pad of a previous run still plugged on slot {}", i + 1);
+        }
+        m_probes.changed(i);
+      }
+    }
+  }
+
+  /// Goal of a slot, for `reconcile()`
+  enum class SlotGoal {
+    Any,  // leave as is
+    Reserved,  // plugged, with a managed pad if needed
+    Open,  // without managed pad, ready for a real one
+  };
+  using Layout = std::array<SlotGoal, Backend::slot_count>;
+
+  /// Changes needed to reach a layout
+  struct Plan {
+    size_t m_add = 0;  // pads to add
+    std::vector<size_t> m_free;  // slots to free, once pads have been added
+
+    bool empty() const { return m_add == 0 && m_free.empty(); }
+  };
+
+  /// Compute the changes needed to reach a layout from the current state
+  ///
+  /// New pads get the first unplugged slots. To reserve a slot, all unplugged
+  /// slots before it have to be filled too, open ones are freed afterwards.
+  Plan planLayout(Layout const& layout) const {
+    uint32_t reserved = 0;
+    uint32_t open = 0;
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      reserved |= layout[i] == SlotGoal::Reserved ? SlotSnapshot::bit(i) : 0;
+      open |= layout[i] == SlotGoal::Open ? SlotSnapshot::bit(i) : 0;
+    }
+
+    // Fill unplugged slots up to the last reserved one
+    auto const current = snapshot();
+    auto const unplugged = ~current.plugged() & (SlotSnapshot::bit(m_slots.size()) - 1);
+    auto const missing = reserved & unplugged;
+    auto const filled = missing ? unplugged & ((SlotSnapshot::bit(std::bit_width(missing) - 1) << 1) - 1) : 0;
+
+    Plan plan;
+    plan.m_add = std::popcount(filled);
+    auto const freed = open & (filled | current.managed());
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      if (freed & SlotSnapshot::bit(i)) {
+        plan.m_free.push_back(i);
+      }
+    }
+    return plan;
+  }
+
+  /// Add and free managed pads to reach a layout
+  ///
+  /// The plan is computed again after being applied, in case pads did not land as expected.
+  /// Return `true` if the layout has been reached.
+  bool reconcile(Layout const& layout) {
+    int constexpr max_attempts = 3;
+    for (int attempt = 0; attempt < max_attempts; ++attempt) {
+      auto const plan = planLayout(layout);
+      if (plan.empty()) {
+        return true;
+      }
+      if (plan.m_add) {
+        fillSlots(plan.m_add);
+      }
+      for (auto const index : plan.m_free) {
+        if (m_slots[index].m_managed) {
+          freeSlot(index);
+        }
+      }
+    }
+
+    if (planLayout(layout).empty()) {
+      return true;
+    }
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      if (layout[i] == SlotGoal::Reserved && !m_slots[i].m_plugged) {
+        ++g_metrics.m_still_unplugged;
+        g_logger.warning("slot {} still unplugged", i + 1);
+      }
+    }
+    return false;
+  }
+
+  /// Fill all slots except the given one
+  ///
+  /// Do nothing if state is already fine.
+  void fillAllButOne(size_t index) {
+    Layout layout;
+    layout.fill(SlotGoal::Reserved);
+    layout.at(index) = SlotGoal::Open;
+    reconcile(layout);
+  }
+
+  /// Free all managed slots
+  void freeAll() {
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      if (m_slots[i].m_managed) {
+        freeSlot(i);
+      }
+    }
+  }
+
+  /// Timeouts of waits for a virtual pad
+  struct Timeouts {
+    Duration m_index = std::chrono::milliseconds(1000);  // find the slot of a new pad, when not notified
+    Duration m_free = std::chrono::milliseconds(1000);  // a removed pad is unplugged
+    Duration m_add = std::chrono::milliseconds(5000);  // pads added at once are registered
+  };
+
+  /// Probe a single slot, record the result
+  bool probe(size_t index) {
+    if (!g_recorder.m_enabled) {
+      return m_backend.isPadPlugged(index);
+    }
+    auto const start = m_backend.now();
+    bool const plugged = m_backend.isPadPlugged(index);
+    g_recorder.record(RecordKind::Probe, start.time_since_epoch(), m_backend.now() - start, index, plugged);
+    return plugged;
+  }
+
+  /// Report managed slots to the backend, if supported
+  void saveManaged() {
+    if constexpr (requires(Backend& backend, std::array<bool, Backend::slot_count> const& managed) { backend.saveManaged(managed); }) {
+      std::array<bool, Backend::slot_count> managed;
+      for (size_t i = 0; i < m_slots.size(); ++i) {
+        managed[i] = m_slots[i].m_managed != nullptr;
+      }
+      m_backend.saveManaged(managed);
+    }
+  }
+
+  static constexpr Duration tight_poll_period = std::chrono::milliseconds(2);
+  static constexpr Duration tight_poll_duration = std::chrono::milliseconds(50);
+  static constexpr Duration max_poll_period = std::chrono::milliseconds(20);
+
+  Backend m_backend;
+  Timeouts m_timeouts;
+  std::array<Slot, Backend::slot_count> m_slots;
+  ProbeScheduler<typename Backend::Clock, Backend::slot_count> m_probes;
+};
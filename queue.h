@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <optional>
+
+/// Lock-free single-producer, single-consumer queue
+///
+/// `push()` must always be called from the same thread, `pop()` from another one.
+template <class T, size_t N>
+struct SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+  /// Add an item, return `false` if the queue is full
+  bool push(T const& item) {
+    auto const tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    m_items[tail % N] = item;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove the oldest item, return `std::nullopt` if the queue is empty
+  std::optional<T> pop() {
+    auto const head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    T item = m_items[head % N];
+    m_head.store(head + 1, std::memory_order_release);
+    return item;
+  }
+
+  std::array<T, N> m_items{};
+  alignas(64) std::atomic<size_t> m_head = 0;  // written by the consumer
+  alignas(64) std::atomic<size_t> m_tail = 0;  // written by the producer
+};
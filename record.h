@@ -0,0 +1,132 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// Kind of a recorded event
+enum class RecordKind: uint8_t {
+  Initial,  // slot probed at startup; `m_value` is the plugged state
+  Probe,  // slot probed; `m_value` is the plugged state
+  Physical,  // unmanaged slot changed; `m_value` is the plugged state
+  Add,  // virtual pads added; `m_value` is the count
+  Place,  // virtual pad placed on a slot; `m_value` is 1 if its index has been notified, 0 if polled
+  Remove,  // virtual pad removed from a slot
+  Freed,  // end of the wait for a removed pad; `m_value` is 1 if the slot is still plugged
+  Target,  // target slot changed; no slot if there is no target anymore
+  Reached,  // a real pad is plugged in the target slot
+};
+
+/// Record slot events and their timings, for replay on a simulated backend
+///
+/// Records have a fixed size and are written to a compact binary file, by blocks.
+/// At most a block is lost if the process is killed, memory use does not grow with the recording.
+/// Times are taken from the backend's clock, without conversion.
+struct Recorder {
+  using Duration = std::chrono::nanoseconds;
+
+  static constexpr uint8_t no_slot = 0xff;
+
+  struct Record {
+    int64_t m_time;  // nanoseconds, since the epoch of the backend's clock
+    uint32_t m_duration_us;
+    RecordKind m_kind;
+    uint8_t m_slot;
+    uint8_t m_value;
+    uint8_t m_reserved;
+  };
+  static_assert(sizeof(Record) == 16);
+
+  struct Header {
+    char m_magic[4];
+    uint32_t m_version;
+  };
+
+  static constexpr Header header = {{'G', 'S', 'R', 'C'}, 1};
+  static constexpr size_t block_size = 256;  // records written at once
+
+  /// Start recording to a binary file
+  void open(std::string const& path) {
+    m_out.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_out.write(reinterpret_cast<char const*>(&header), sizeof(header))) {
+      throw std::runtime_error(std::format("cannot open record file: {}", path));
+    }
+    m_path = path;
+    m_records.reserve(block_size);
+    m_enabled = true;
+  }
+
+  /// Write pending records and stop recording
+  void close() {
+    if (!m_enabled) {
+      return;
+    }
+    std::lock_guard lock(m_mutex);
+    m_enabled = false;
+    writeBlock();
+    m_out.close();
+    if (m_out.fail()) {
+      throw std::runtime_error(std::format("failed to write record file: {}", m_path));
+    }
+  }
+
+  /// Record an event which occurred at `time`
+  ///
+  /// Can be called from any thread.
+  void record(RecordKind kind, Duration time, Duration duration = {}, std::optional<size_t> slot = std::nullopt, uint8_t value = 0) {
+    if (m_enabled) {
+      auto const duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+      Record const record = {time.count(), static_cast<uint32_t>(duration_us), kind,
+                             slot ? static_cast<uint8_t>(*slot) : no_slot, value, 0};
+      std::lock_guard lock(m_mutex);
+      m_records.push_back(record);
+      if (m_records.size() >= block_size) {
+        writeBlock();
+      }
+    }
+  }
+
+  /// Read records from a binary file
+  static std::vector<Record> read(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      throw std::runtime_error(std::format("cannot open record file: {}", path));
+    }
+    Header file_header;
+    if (!in.read(reinterpret_cast<char*>(&file_header), sizeof(file_header)) ||
+        std::memcmp(file_header.m_magic, header.m_magic, sizeof(header.m_magic)) != 0) {
+      throw std::runtime_error(std::format("invalid record file: {}", path));
+    }
+    if (file_header.m_version != header.m_version) {
+      throw std::runtime_error(std::format("unsupported record file version: {}", file_header.m_version));
+    }
+    std::vector<Record> records;
+    Record record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+      records.push_back(record);
+    }
+    return records;
+  }
+
+  bool m_enabled = false;
+  std::mutex m_mutex;  // protect `m_records` and `m_out`
+  std::vector<Record> m_records;  // pending block
+  std::ofstream m_out;
+  std::string m_path;
+
+ private:
+  /// Write pending records, errors are reported by `close()`
+  void writeBlock() {
+    m_out.write(reinterpret_cast<char const*>(m_records.data()), m_records.size() * sizeof(Record));
+    m_out.flush();
+    m_records.clear();
+  }
+};
+
+inline Recorder g_recorder;
@@ -0,0 +1,279 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+
+/// Simulated XInput and ViGEm backend of `ConnectedPads`, for benchmarks
+///
+/// Time is simulated: probes and waits advance a virtual clock and return immediately.
+/// Slots are assigned like XInput does: a new device gets the first free slot.
+/// A device plugged while all slots are used gets the next freed slot.
+struct SimBackend {
+  struct Clock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<Clock>;
+    static constexpr bool is_steady = true;
+  };
+  using Time = Clock::time_point;
+  using Duration = Clock::duration;
+
+  static constexpr size_t slot_count = 4;
+
+  /// Timings and behavior of the simulated driver
+  struct Config {
+    Duration add_latency = 2ms;  // blocking part of `addPad()` and `addPads()`
+    Duration add_stagger = 1ms;  // delay between assignments of pads added at once
+    Duration assign_latency = 40ms;  // until a new virtual pad is assigned a slot
+    Duration remove_latency = 20ms;  // until a removed virtual pad frees its slot
+    std::optional<Duration> notification_latency = 2ms;  // after assignment; unset if notifications are not available
+    bool user_index_query = false;  // whether `queryPadIndex()` succeeds
+    Duration probe_plugged_cost = 20us;
+    Duration probe_empty_cost = 600us;
+  };
+
+  /// Change of a physical device, at a given time
+  struct PhysicalEvent {
+    Duration m_time;
+    size_t m_device;  // arbitrary device identifier
+    bool m_plugged;
+  };
+
+  /// A simulated device, physical or virtual
+  struct Device {
+    bool m_virtual = false;
+    bool m_cancelled = false;  // removed before being assigned a slot
+    std::optional<size_t> m_slot;
+    Time m_assigned_at{};
+  };
+  using Pad = Device*;
+
+  struct Stats {
+    size_t m_probes = 0;
+    Duration m_probe_time{};  // total simulated cost of probes
+    size_t m_added = 0;
+    size_t m_removed = 0;
+  };
+
+  SimBackend(Config const& config, std::vector<PhysicalEvent> const& events): m_config(config) {
+    for (auto const& event : events) {
+      schedulePhysical(event);
+    }
+    advance(m_now);  // apply events at time 0
+  }
+
+  SimBackend(SimBackend const&) = delete;
+  SimBackend& operator=(SimBackend const&) = delete;
+
+  /// Schedule a change of a physical device, at an absolute time
+  void schedulePhysical(PhysicalEvent const& event) {
+    schedule(Time(event.m_time), {event.m_plugged ? Event::Plug : Event::Unplug, nullptr, event.m_device});
+  }
+
+  Time now() const { return m_now; }
+  void sleep(Duration delay) { advance(m_now + delay); }
+  void sleepUntil(Time time) { advance(time); }
+
+  bool isPadPlugged(size_t index) {
+    auto const cost = m_slots.at(index) ? m_config.probe_plugged_cost : m_config.probe_empty_cost;
+    ++m_stats.m_probes;
+    m_stats.m_probe_time += cost;
+    advance(m_now + cost);
+    return m_slots[index] != nullptr;
+  }
+
+  /// Probe all slots at once, as if concurrently: cost is the one of the slowest probe
+  std::array<bool, slot_count> probeAll() {
+    std::array<bool, slot_count> plugged;
+    Duration cost{};
+    for (size_t i = 0; i < slot_count; ++i) {
+      plugged[i] = m_slots[i] != nullptr;
+      cost = std::max(cost, plugged[i] ? m_config.probe_plugged_cost : m_config.probe_empty_cost);
+    }
+    m_stats.m_probes += slot_count;
+    m_stats.m_probe_time += cost;
+    advance(m_now + cost);
+    return plugged;
+  }
+
+  Pad addPad() {
+    ++m_stats.m_added;
+    advance(m_now + m_config.add_latency);
+    auto const pad = createDevice(true);
+    schedule(m_now + m_config.assign_latency, {Event::Assign, pad, 0});
+    return pad;
+  }
+
+  std::vector<Pad> addPads(size_t count, Duration /* timeout */) {
+    m_stats.m_added += count;
+    advance(m_now + m_config.add_latency);
+    std::vector<Pad> pads;
+    for (size_t i = 0; i < count; ++i) {
+      auto const pad = createDevice(true);
+      schedule(m_now + m_config.assign_latency + m_config.add_stagger * i, {Event::Assign, pad, 0});
+      pads.push_back(pad);
+    }
+    return pads;
+  }
+
+  void removePad(Pad pad) {
+    ++m_stats.m_removed;
+    schedule(m_now + m_config.remove_latency, {Event::Release, pad, 0});
+  }
+
+  std::optional<size_t> waitPadIndex(Pad pad, Time deadline) {
+    if (m_config.notification_latency) {
+      for (;;) {
+        if (pad->m_slot) {
+          auto const notified_at = pad->m_assigned_at + *m_config.notification_latency;
+          if (notified_at > deadline) {
+            break;
+          }
+          advance(std::max(m_now, notified_at));
+          return pad->m_slot;
+        }
+        auto const next = m_events.begin();
+        if (next == m_events.end() || next->first > deadline) {
+          break;
+        }
+        advance(next->first);
+      }
+    }
+    advance(std::max(m_now, deadline));
+    return std::nullopt;
+  }
+
+  std::optional<size_t> queryPadIndex(Pad pad) {
+    return m_config.user_index_query ? pad->m_slot : std::nullopt;
+  }
+
+  /// Return `true` if a device actually uses the given slot
+  bool isSlotUsed(size_t index) const { return m_slots.at(index) != nullptr; }
+
+  /// Return `true` if a physical device uses the given slot
+  bool hasPhysicalDevice(size_t index) const {
+    auto const device = m_slots.at(index);
+    return device && !device->m_virtual;
+  }
+
+  /// Return the number of virtual pads allocated and not released yet
+  size_t liveTargets() const {
+    return std::ranges::count_if(m_devices, [](auto const& device) { return device->m_virtual; });
+  }
+
+  /// Return the number of devices, physical or virtual, not destroyed yet
+  size_t deviceCount() const { return m_devices.size(); }
+
+  /// Return the number of driver and physical events not processed yet
+  size_t pendingEvents() const { return m_events.size(); }
+
+  Stats const& stats() const { return m_stats; }
+
+ private:
+  struct Event {
+    enum Kind { Assign, Release, Plug, Unplug } m_kind;
+    Device* m_device;  // for virtual pads
+    size_t m_physical;  // for physical devices
+  };
+
+  void schedule(Time time, Event event) {
+    m_events.emplace(time, event);  // events at the same time are kept in order
+  }
+
+  /// Process events up to the given time
+  void advance(Time time) {
+    while (!m_events.empty() && m_events.begin()->first <= time) {
+      auto const [at, event] = *m_events.begin();
+      m_events.erase(m_events.begin());
+      m_now = std::max(m_now, at);
+      process(event);
+    }
+    m_now = std::max(m_now, time);
+  }
+
+  void process(Event const& event) {
+    switch (event.m_kind) {
+      case Event::Assign:
+        if (event.m_device->m_cancelled) {
+          destroyDevice(event.m_device);
+        } else {
+          assign(event.m_device);
+        }
+        break;
+      case Event::Release:
+        release(event.m_device);
+        break;
+      case Event::Plug: {
+        auto const device = createDevice(false);
+        m_physical[event.m_physical] = device;
+        assign(device);
+        break;
+      }
+      case Event::Unplug: {
+        auto it = m_physical.find(event.m_physical);
+        if (it != m_physical.end()) {
+          release(it->second);
+          m_physical.erase(it);
+        }
+        break;
+      }
+    }
+  }
+
+  void assign(Device* device) {
+    auto it = std::ranges::find(m_slots, nullptr);
+    if (it == m_slots.end()) {
+      m_waiting.push_back(device);
+      return;
+    }
+    *it = device;
+    device->m_slot = it - m_slots.begin();
+    device->m_assigned_at = m_now;
+  }
+
+  void release(Device* device) {
+    if (device->m_slot) {
+      m_slots[*device->m_slot] = nullptr;
+      destroyDevice(device);
+      if (!m_waiting.empty()) {
+        auto const next = m_waiting.front();
+        m_waiting.erase(m_waiting.begin());
+        assign(next);
+      }
+    } else if (auto it = std::ranges::find(m_waiting, device); it != m_waiting.end()) {
+      m_waiting.erase(it);
+      destroyDevice(device);
+    } else {
+      device->m_cancelled = true;  // will be destroyed instead of being assigned
+    }
+  }
+
+  Device* createDevice(bool is_virtual) {
+    auto device = std::make_unique<Device>();
+    device->m_virtual = is_virtual;
+    m_devices.push_back(std::move(device));
+    return m_devices.back().get();
+  }
+
+  void destroyDevice(Device* device) {
+    std::erase_if(m_devices, [&](auto const& p) { return p.get() == device; });
+  }
+
+  Config m_config;
+  Time m_now{};
+  std::multimap<Time, Event> m_events;
+  std::array<Device*, slot_count> m_slots{};
+  std::vector<Device*> m_waiting;
+  std::map<size_t, Device*> m_physical;
+  std::vector<std::unique_ptr<Device>> m_devices;
+  Stats m_stats;
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Record durations of the main phases, for latency analysis
+///
+/// Records are only kept when enabled. A summary is printed at exit.
+struct Tracer {
+  using Clock = std::chrono::steady_clock;
+
+  struct Record {
+    std::string_view m_phase;
+    std::optional<size_t> m_slot;
+    Clock::time_point m_start;
+    Clock::duration m_duration;
+  };
+
+  /// Record a phase which started at `start` and ends now
+  ///
+  /// Can be called from any thread.
+  void record(std::string_view phase, Clock::time_point start, std::optional<size_t> slot = std::nullopt) {
+    if (m_enabled) {
+      auto const duration = Clock::now() - start;
+      std::lock_guard lock(m_mutex);
+      m_records.push_back({phase, slot, start, duration});
+    }
+  }
+
+  /// Record a phase for the lifetime of the object
+  struct Scope {
+    Scope(Tracer& tracer, std::string_view phase, std::optional<size_t> slot = std::nullopt):
+        m_tracer(tracer), m_phase(phase), m_slot(slot), m_start(Clock::now()) {}
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+    ~Scope() { m_tracer.record(m_phase, m_start, m_slot); }
+
+    Tracer& m_tracer;
+    std::string_view m_phase;
+    std::optional<size_t> m_slot;
+    Clock::time_point m_start;
+  };
+
+  Scope scope(std::string_view phase, std::optional<size_t> slot = std::nullopt) {
+    return Scope(*this, phase, slot);
+  }
+
+  /// Print count, min, mean and max duration of each phase
+  void printSummary(std::ostream& out) const {
+    struct Stats {
+      size_t count = 0;
+      Clock::duration min = Clock::duration::max();
+      Clock::duration max = Clock::duration::zero();
+      Clock::duration total = Clock::duration::zero();
+    };
+    // Keep phases in order of first appearance
+    std::vector<std::pair<std::string_view, Stats>> phases;
+    for (auto const& record : m_records) {
+      auto it = std::ranges::find(phases, record.m_phase, &decltype(phases)::value_type::first);
+      if (it == phases.end()) {
+        it = phases.insert(phases.end(), {record.m_phase, {}});
+      }
+      auto& stats = it->second;
+      ++stats.count;
+      stats.min = std::min(stats.min, record.m_duration);
+      stats.max = std::max(stats.max, record.m_duration);
+      stats.total += record.m_duration;
+    }
+
+    auto const ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    out << std::format("{:<20} {:>6} {:>11} {:>11} {:>11}\n", "phase", "count", "min (ms)", "mean (ms)", "max (ms)");
+    for (auto const& [phase, stats] : phases) {
+      out << std::format("{:<20} {:>6} {:>11.3f} {:>11.3f} {:>11.3f}\n",
+                         phase, stats.count, ms(stats.min), ms(stats.total) / stats.count, ms(stats.max));
+    }
+  }
+
+  /// Write all records to a CSV file
+  void writeCsv(std::string const& path) const {
+    std::ofstream out(path);
+    if (!out) {
+      throw std::runtime_error(std::format("cannot open trace file: {}", path));
+    }
+    auto const us = [](Clock::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+    out << "phase,slot,start_us,duration_us\n";
+    for (auto const& record : m_records) {
+      out << std::format("{},{},{},{}\n", record.m_phase, record.m_slot ? std::to_string(*record.m_slot + 1) : "",
+                         us(record.m_start - m_origin), us(record.m_duration));
+    }
+  }
+
+  bool m_enabled = false;
+  Clock::time_point m_origin = Clock::now();
+  std::mutex m_mutex;  // protect `m_records` while recording; other threads must be stopped to read them
+  std::vector<Record> m_records;
+};
+
+inline Tracer g_tracer;